@@ -28,6 +28,21 @@
 #import "OESNESSystemResponderClient.h"
 #import <stdint.h>
 
+typedef NS_OPTIONS(NSUInteger, BSNESAdvanceFlags) {
+    BSNESAdvanceFlagsNone  = 0,
+    BSNESAdvanceSkipVideo  = 1 << 0,  /* don't convert frames to the video buffer */
+    BSNESAdvanceSkipAudio  = 1 << 1,  /* don't write samples to the audio buffer */
+};
+
+typedef NS_ENUM(NSUInteger, BSNESStateCompression) {
+    BSNESStateCompressionNone = 0,
+    BSNESStateCompressionLZMA = 1,  /* smallest files, the default */
+    BSNESStateCompressionLZ4  = 2,  /* fastest to save and load */
+};
+
+/* no node of the state tree */
+static const NSUInteger BSNESStateNodeNone = NSNotFound;
+
 OE_EXPORTED_CLASS
 @interface BSNESGameCore : OEGameCore {
 @public
@@ -37,4 +52,102 @@ OE_EXPORTED_CLASS
     uint32_t *videoBuffer;
 }
 
+/* Runs the emulation for the given amount of frames without going through the
+ * OpenEmu frame loop. The flags only suppress output. Every frame is captured
+ * by the rewind buffer and counts towards the battery RAM flushing, like a
+ * call to -executeFrame, but exactly one frame is emulated per frame asked
+ * for: fast-forward does not multiply them, and rewinding is ignored. A
+ * pending resume snapshot is discarded. Must not be called during a netplay
+ * session, which it would desynchronize.
+ * Returns the measured speed of the core in frames per second. */
+- (double)advanceFrames:(NSUInteger)frames flags:(BSNESAdvanceFlags)flags;
+
+/* Size in bytes of a save state of the loaded game. It does not change until
+ * another game is loaded, so a buffer of this size can be allocated once and
+ * reused by -serializeStateIntoBuffer:length: for every snapshot. */
+- (NSUInteger)serializedStateSize;
+- (BOOL)serializeStateIntoBuffer:(void *)buffer length:(NSUInteger)length;
+
+/* Compression of the save state files written by
+ * -saveStateToFileAtPath:completionHandler:. Files written by any setting, as
+ * well as the uncompressed files of older versions, can always be loaded.
+ * Saving only takes the snapshot on the calling thread: the file is
+ * compressed and written in the background, and the completion handler is
+ * called from a background queue once it is safely on disk. */
+@property (nonatomic) BSNESStateCompression stateCompression;
+
+/* When set (off by default), the state is saved when the emulation stops and
+ * restored right before the first frame the next time the same game is
+ * loaded by the same version of the core, unless its battery save changed
+ * in between. Must be set before -loadFileAtPath:error:. */
+@property (nonatomic) BOOL instantResume;
+
+/* Incremental states only contain the pages of the state (256 bytes to 4 KiB,
+ * 1 KiB by default) which changed since the previous incremental state. The
+ * first one after setting the page size contains every page. A receiver must
+ * apply every incremental state, in order, starting from that first one. */
+- (void)setIncrementalStatePageSize:(NSUInteger)pageSize;
+- (NSData *)serializeIncrementalState;
+- (BOOL)deserializeIncrementalState:(NSData *)state;
+
+/* State tree, for searches and tool-assisted runs which fork many states
+ * from a common ancestor. Nodes share the pages of the state (1 KiB) that are
+ * identical to their parent's, so they only cost the memory of the pages that
+ * differ. Capturing with BSNESStateNodeNone as the parent creates a root;
+ * forking duplicates a node in constant time. */
+- (NSUInteger)captureStateNodeWithParent:(NSUInteger)parent;
+- (NSUInteger)forkStateNode:(NSUInteger)node;
+- (BOOL)restoreStateNode:(NSUInteger)node;
+- (void)releaseStateNode:(NSUInteger)node;
+- (NSUInteger)stateTreeMemoryUsage;
+
+/* Tunes the behavior of -fastForward:. Each -executeFrame runs `speed` frames,
+ * the last frame out of every `videoInterval` is converted, one audio sample
+ * out of `audioInterval` is kept (0 mutes the audio), and when `speedHacks`
+ * is set the coprocessors are allowed to run out of sync for the duration.
+ * OpenEmu also calls -executeFrame faster while fast-forwarding, so the
+ * emulation runs at `speed` times OpenEmu's own fast-forward rate. */
+- (void)setFastForwardSpeed:(NSUInteger)speed videoInterval:(NSUInteger)videoInterval audioInterval:(NSUInteger)audioInterval speedHacks:(BOOL)speedHacks;
+
+/* Enables the core's own rewind buffer, which takes a snapshot every `frames`
+ * frames and keeps as many as fit in `bytes` once compressed; -rewind: then
+ * steps through it instead of OpenEmu's rewind queue. 0 frames disables it. */
+- (void)setRewindInterval:(NSUInteger)frames memoryBudget:(NSUInteger)bytes;
+
+/* Measures the input-to-photon latency: presses `button` once per trial and
+ * counts the frames until the output changes, looking either at the pixel at
+ * `probe` or, when `probe` is {-1, -1}, at a hash of the whole frame.
+ * Works without a video buffer, so it can run headless right after
+ * -loadFileAtPath:error:. The result holds the individual samples and their
+ * distribution in emulated frames, emulated milliseconds and host
+ * milliseconds. */
+- (NSDictionary<NSString *, id> *)measureInputLatencyForButton:(OESNESButton)button player:(NSUInteger)player probe:(OEIntPoint)probe trials:(NSUInteger)trials;
+
+/* Time spent in each phase of the last -loadFileAtPath:error:, from reading
+ * the file to powering the system on, in milliseconds. The same profile is
+ * logged after every load. */
+- (NSDictionary<NSString *, NSNumber *> *)loadProfile;
+/* For batch runs: keeps the profiles of every load of the process from now
+ * on, and summarizes each phase (min, median, p95, max, mean) along with the
+ * number of loads. */
++ (void)setAggregatesLoadProfiles:(BOOL)flag;
++ (NSDictionary<NSString *, id> *)aggregateLoadProfile;
+
+/* Rollback netplay. The local player always uses the controls of OpenEmu's
+ * player 1, and is connected to the given SNES controller port. Starting a
+ * session powers the system on again, so both peers start in the same state;
+ * the emulation waits until the peer has confirmed it runs the same ROM on
+ * the same version of the core. The socket only accepts connections from
+ * other hosts if the remote host is not on the loopback interface. */
+- (BOOL)startNetplayAsPlayer:(NSUInteger)player localPort:(uint16_t)localPort remoteHost:(NSString *)host remotePort:(uint16_t)remotePort;
+/* Starts a session against an in-process fake peer which mirrors the local
+ * inputs with the given latency, for testing without a network. */
+- (void)startLoopbackNetplayAsPlayer:(NSUInteger)player delay:(NSUInteger)frames;
+- (void)stopNetplay;
+/* Why the last session stopped on its own (a different ROM, core version or
+ * starting state on the other side, or a rollback which could not be done),
+ * or nil. The emulation goes on locally from there. Cleared when a session
+ * starts. */
+@property (nonatomic, readonly, copy) NSString *netplayError;
+
 @end
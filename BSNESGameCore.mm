@@ -33,6 +33,13 @@
 #undef BSD
 
 #include "program.mm"
+#include "netplay.mm"
+#include "latency.mm"
+#include "rewind.mm"
+#include "snapshot.mm"
+#include "savestate.mm"
+#include "sram.mm"
+#include "resume.mm"
 
 
 /*
@@ -45,6 +52,13 @@
 @implementation BSNESGameCore {
     NSMutableSet <NSString *> *_activeCheats;
     NSMutableDictionary <NSString *, id> *_displayModes;
+    Rewind *_rewind;
+    BOOL _rewinding;
+    IncrementalSnapshot *_incrementalSnapshot;
+    StateTree *_stateTree;
+    SaveRamFlush *_saveRamFlush;
+    ResumeSnapshot *_resume;
+    dispatch_queue_t _stateQueue;
 }
 
 - (id)init
@@ -55,11 +69,23 @@
     _activeCheats = [[NSMutableSet alloc] init];
     _displayModes = [[NSMutableDictionary alloc] init];
     screenRect = OEIntRectMake(0, 0, 256, 224);
+    _stateCompression = BSNESStateCompressionLZMA;
+    _stateQueue = dispatch_queue_create("org.openemu.BSNES.states", DISPATCH_QUEUE_SERIAL);
     return self;
 }
 
 - (void)dealloc
 {
+    //pending state writes reference the serializers they own, not the core,
+    //but a pending resume snapshot references _resume
+    dispatch_sync(_stateQueue, ^{});
+    delete _rewind;
+    delete _incrementalSnapshot;
+    delete _stateTree;
+    delete _saveRamFlush;
+    delete _resume;
+    delete netplay;
+    netplay = nullptr;
     delete emulator;
     delete program;
 }
@@ -197,6 +223,9 @@
     program->superFamicom.location = string(fullPath);
     program->base_name = string(fullPath);
     program->load();
+    if (!_saveRamFlush)
+        _saveRamFlush = new SaveRamFlush;
+    _saveRamFlush->reset();
     
     if (program->failedLoadingAtLeastOneRequiredFile) {
         NSError *outErr;
@@ -221,19 +250,112 @@
     emulator->connect(SuperFamicom::ID::Port::Controller2, SuperFamicom::ID::Device::Gamepad);
     [self loadCheats];
     
+    //the previous game's snapshot may still be being prepared
+    dispatch_sync(_stateQueue, ^{});
+    delete _resume;
+    _resume = nullptr;
+    if (_instantResume) {
+        NSString *directory = [self.supportDirectoryPath stringByAppendingPathComponent:@"Resume/"];
+        _resume = new ResumeSnapshot(directory.fileSystemRepresentation, program->superFamicom.sha256, program->saveRamPath());
+        /* reading and decompressing the snapshot overlaps with whatever
+         * OpenEmu does before the first frame */
+        ResumeSnapshot *resume = _resume;
+        resume->pending = true;
+        dispatch_async(_stateQueue, ^{
+            resume->prepare();
+            resume->prune();
+        });
+    }
+    
     return YES;
 }
 
 - (NSData *)serializeStateWithError:(NSError *__autoreleasing *)outError
 {
-    serializer s = emulator->serialize();
-    return [NSData dataWithBytes:s.data() length:s.size()];
+    /* hand the serializer's own storage to NSData instead of copying it */
+    serializer *s = new serializer(emulator->serialize());
+    return [[NSData alloc] initWithBytesNoCopy:(void *)s->data() length:s->size() deallocator:^(void *bytes, NSUInteger length) {
+        delete s;
+    }];
+}
+
+- (void)setIncrementalStatePageSize:(NSUInteger)pageSize
+{
+    delete _incrementalSnapshot;
+    _incrementalSnapshot = new IncrementalSnapshot((uint)min(pageSize, (NSUInteger)4096));
+}
+
+- (NSData *)serializeIncrementalState
+{
+    if (!_incrementalSnapshot)
+        [self setIncrementalStatePageSize:1024];
+    vector<uint8_t> *snapshot = new vector<uint8_t>(_incrementalSnapshot->capture());
+    return [[NSData alloc] initWithBytesNoCopy:snapshot->data() length:snapshot->size() deallocator:^(void *bytes, NSUInteger length) {
+        delete snapshot;
+    }];
+}
+
+- (BOOL)deserializeIncrementalState:(NSData *)state
+{
+    if (!_incrementalSnapshot)
+        [self setIncrementalStatePageSize:1024];
+    return _incrementalSnapshot->apply((const uint8_t *)state.bytes, (uint)state.length);
+}
+
+- (NSUInteger)captureStateNodeWithParent:(NSUInteger)parent
+{
+    if (!_stateTree)
+        _stateTree = new StateTree(1024);
+    uint node = _stateTree->capture(parent == BSNESStateNodeNone ? StateTree::None : (uint)parent);
+    return node == StateTree::None ? BSNESStateNodeNone : node;
+}
+
+- (NSUInteger)forkStateNode:(NSUInteger)node
+{
+    if (!_stateTree || node == BSNESStateNodeNone) return BSNESStateNodeNone;
+    uint child = _stateTree->fork((uint)node);
+    return child == StateTree::None ? BSNESStateNodeNone : child;
+}
+
+- (BOOL)restoreStateNode:(NSUInteger)node
+{
+    return _stateTree && node != BSNESStateNodeNone && _stateTree->restore((uint)node);
+}
+
+- (void)releaseStateNode:(NSUInteger)node
+{
+    if (_stateTree && node != BSNESStateNodeNone)
+        _stateTree->release((uint)node);
+}
+
+- (NSUInteger)stateTreeMemoryUsage
+{
+    return _stateTree ? (NSUInteger)_stateTree->memoryUsage() : 0;
+}
+
+- (NSUInteger)serializedStateSize
+{
+    return program->stateSize();
+}
+
+- (BOOL)serializeStateIntoBuffer:(void *)buffer length:(NSUInteger)length
+{
+    return program->serializeInto((uint8_t *)buffer, (uint)min(length, (NSUInteger)UINT_MAX)) != 0;
+}
+
+/* Anything replacing or driving the emulated state wins over the resume
+ * snapshot, which would otherwise overwrite it on the next frame */
+- (void)discardResumeSnapshot
+{
+    if (!_resume || !_resume->pending) return;
+    dispatch_sync(_stateQueue, ^{});
+    _resume->discard();
 }
 
 - (BOOL)deserializeState:(NSData *)state withError:(NSError *__autoreleasing *)outError
 {
-    serializer s(static_cast<const uint8_t *>(state.bytes), (uint)state.length);
-    BOOL res = emulator->unserialize(s);
+    [self discardResumeSnapshot];
+    BOOL res = state.length <= UINT_MAX && program->unserialize(static_cast<const uint8_t *>(state.bytes), (uint)state.length);
     if (!res && outError)
         *outError = [NSError
             errorWithDomain:OEGameCoreErrorDomain
@@ -247,16 +369,44 @@
 
 - (void)saveStateToFileAtPath:(NSString *)fileName completionHandler:(void (^)(BOOL, NSError *))block
 {
-    NSData *stateData = [self serializeStateWithError:nil];
-    
-    __autoreleasing NSError *error = nil;
-    BOOL success = [stateData writeToFile:fileName options:NSDataWritingAtomic error:&error];
-    
-    block(success, success ? nil : error);
+    /* Only the snapshot is taken on the emulation thread. Compressing and
+     * writing happen on the state queue, and the completion handler is called
+     * from there once the file has been synced to disk. */
+    serializer *s = new serializer(emulator->serialize());
+    StateFile::Header header;
+    header.codec = (StateFile::Codec)_stateCompression;
+    header.sha256 = program->superFamicom.sha256;
+    header.region = program->superFamicom.region;
+    header.serializerVersion = Emulator::SerializerVersion;
+    string path = fileName.fileSystemRepresentation;
+
+    dispatch_async(_stateQueue, ^{
+        //compression failures leave errno alone, so it is only trusted if set here
+        errno = 0;
+        bool success = StateFile::write(path, s->data(), s->size(), header);
+        int code = errno;
+        delete s;
+        if (!success) {
+            NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
+            userInfo[NSLocalizedDescriptionKey] = @"The save state could not be written.";
+            if (code)
+                userInfo[NSUnderlyingErrorKey] = [NSError errorWithDomain:NSPOSIXErrorDomain code:code userInfo:nil];
+            block(NO, [NSError
+                errorWithDomain:OEGameCoreErrorDomain
+                code:OEGameCoreCouldNotSaveStateError
+                userInfo:userInfo]);
+            return;
+        }
+        block(YES, nil);
+    });
 }
 
 - (void)loadStateFromFileAtPath:(NSString *)fileName completionHandler:(void (^)(BOOL, NSError *))block
 {
+    //the state may still be on its way to the disk
+    dispatch_sync(_stateQueue, ^{});
+    [self discardResumeSnapshot];
+
     __autoreleasing NSError *error = nil;
     NSData *data = [NSData dataWithContentsOfFile:fileName options:NSDataReadingMappedIfSafe | NSDataReadingUncached error:&error];
     
@@ -264,9 +414,73 @@
         block(NO, error);
         return;
     }
-    
-    BOOL success = [self deserializeState:data withError:&error];
-    block(success, success ? nil : error);
+
+    const uint8_t *bytes = (const uint8_t *)data.bytes;
+    StateFile::Header header;
+    if (!StateFile::parse(bytes, (uint)data.length, header)) {
+        /* states of older versions are the raw serializer data */
+        BOOL success = [self deserializeState:data withError:&error];
+        block(success, success ? nil : error);
+        return;
+    }
+
+    if (header.sha256 != program->superFamicom.sha256) {
+        block(NO, [NSError
+            errorWithDomain:OEGameCoreErrorDomain
+            code:OEGameCoreCouldNotLoadStateError
+            userInfo:@{
+                NSLocalizedDescriptionKey: @"The save state belongs to a different game.",
+                NSLocalizedRecoverySuggestionErrorKey: @"The save state was made with a different version or dump of this game, and cannot be loaded."
+            }]);
+        return;
+    }
+
+    if (header.serializerVersion != Emulator::SerializerVersion) {
+        block(NO, [NSError
+            errorWithDomain:OEGameCoreErrorDomain
+            code:OEGameCoreCouldNotLoadStateError
+            userInfo:@{
+                NSLocalizedDescriptionKey: @"The save state was made with a different version of the BSNES core.",
+                NSLocalizedRecoverySuggestionErrorKey: @"When the BSNES core is updated, existing save states may stop working. This is normal and unavoidable.\n\nPlease use in-game saves as much as possible instead."
+            }]);
+        return;
+    }
+
+    if (header.region != program->superFamicom.region) {
+        block(NO, [NSError
+            errorWithDomain:OEGameCoreErrorDomain
+            code:OEGameCoreCouldNotLoadStateError
+            userInfo:@{
+                NSLocalizedDescriptionKey: @"The save state was made for a different video region.",
+                NSLocalizedRecoverySuggestionErrorKey: [NSString stringWithFormat:@"The save state was made while the game ran as %s, but it is now running as %s.", header.region.data(), program->superFamicom.region.data()]
+            }]);
+        return;
+    }
+
+    /* uncompressed states are loaded straight from the mapped file, the others
+     * are decoded into a buffer that is kept around for the next load */
+    const uint8_t *payload = bytes + StateFile::Header::Size;
+    uint payloadSize = (uint)data.length - StateFile::Header::Size;
+    BOOL success = header.size <= UINT_MAX;
+    if (success && header.codec == StateFile::Codec::None) {
+        success = header.size == payloadSize && program->unserialize(payload, payloadSize);
+    } else if (success) {
+        vector<uint8_t>& state = program->stateBuffer;
+        if (state.size() != header.size) state.resize(header.size);
+        success = StateFile::decompress(header, payload, payloadSize, state.data())
+            && program->unserialize(state.data(), (uint)state.size());
+    }
+    if (!success) {
+        block(NO, [NSError
+            errorWithDomain:OEGameCoreErrorDomain
+            code:OEGameCoreCouldNotLoadStateError
+            userInfo:@{
+                NSLocalizedDescriptionKey: @"The save state data could not be read.",
+                NSLocalizedRecoverySuggestionErrorKey: @"When the BSNES core is updated, existing save states may stop working. This is normal and unavoidable.\n\nPlease use in-game saves as much as possible instead."
+            }]);
+        return;
+    }
+    block(YES, nil);
 }
 
 
@@ -311,21 +525,214 @@
 
 - (void)executeFrame
 {
-    emulator->run();
+    if (_resume && _resume->pending) {
+        dispatch_sync(_stateQueue, ^{});
+        _resume->restore();
+    }
+    
+    if (netplay) {
+        if (!netplay->runFrame() && netplay->failed()) {
+            //the emulation goes on locally from wherever the session stopped
+            _netplayError = [NSString stringWithUTF8String:netplay->error.data()];
+            [self stopNetplay];
+        }
+        _saveRamFlush->frame();
+        return;
+    }
+    
+    if (_rewinding) {
+        /* show the restored state by emulating one frame from it; the buffer
+         * keeps its own copy, so the next step is unaffected */
+        if (_rewind->step()) {
+            program->skipAudio = true;
+            emulator->run();
+            program->skipAudio = false;
+        }
+        return;
+    }
+    
+    uint frames = program->fastForward.enabled ? program->fastForward.speed : 1;
+    for (uint i = 0; i < frames; i++) {
+        emulator->run();
+        if (_rewind) _rewind->frame();
+    }
+    _saveRamFlush->frame();
+}
+
+- (void)rewind:(BOOL)flag
+{
+    if (!_rewind) {
+        [super rewind:flag];
+        return;
+    }
+    _rewinding = flag;
+}
+
+- (void)setRewindInterval:(NSUInteger)frames memoryBudget:(NSUInteger)bytes
+{
+    delete _rewind;
+    _rewind = frames ? new Rewind((uint)frames, bytes) : nullptr;
+    _rewinding = NO;
+}
+
+- (void)fastForward:(BOOL)flag
+{
+    [super fastForward:flag];
+    program->setFastForward(flag);
+}
+
+- (void)setFastForwardSpeed:(NSUInteger)speed videoInterval:(NSUInteger)videoInterval audioInterval:(NSUInteger)audioInterval speedHacks:(BOOL)speedHacks
+{
+    BOOL wasEnabled = program->fastForward.enabled;
+    program->setFastForward(false);
+    program->fastForward.speed = speed ? (uint)speed : 1;
+    program->fastForward.videoInterval = videoInterval ? (uint)videoInterval : 1;
+    program->fastForward.audioInterval = (uint)audioInterval;
+    program->fastForward.speedHacks = speedHacks;
+    program->setFastForward(wasEnabled);
+}
+
+- (double)advanceFrames:(NSUInteger)frames flags:(BSNESAdvanceFlags)flags
+{
+    //the peer would never see the inputs of these frames
+    NSAssert(!netplay, @"cannot advance during a netplay session");
+    if (netplay) return 0.0;
+    [self discardResumeSnapshot];
+    Rewind *rewind = _rewinding ? nullptr : _rewind;
+    SaveRamFlush *saveRamFlush = _saveRamFlush;
+    return program->advance((uint)frames, (uint)flags, [rewind, saveRamFlush] {
+        if (rewind) rewind->frame();
+        saveRamFlush->frame();
+    });
 }
 
 - (void)resetEmulation
 {
+    [self discardResumeSnapshot];
     emulator->reset();
 }
 
 - (void)stopEmulation
 {
+    [self stopNetplay];
+    //the final save must not be overwritten by an earlier background flush
+    if (_saveRamFlush) _saveRamFlush->drain();
     program->save();
+    dispatch_sync(_stateQueue, ^{});
+    if (_resume && !_resume->pending && !_resume->save())
+        NSLog(@"Failed to write the resume snapshot");
     [super stopEmulation];
 }
 
 
+#pragma mark - Latency Measurement
+
+
+- (NSDictionary<NSString *, id> *)measureInputLatencyForButton:(OESNESButton)button player:(NSUInteger)player probe:(OEIntPoint)probe trials:(NSUInteger)trials
+{
+    NSAssert(player > 0 && player <= 2, @"too many players");
+    LatencyHarness::Settings settings;
+    settings.button = button;
+    settings.player = (uint)player;
+    settings.usePixel = probe.x >= 0 && probe.y >= 0;
+    settings.x = settings.usePixel ? probe.x : 0;
+    settings.y = settings.usePixel ? probe.y : 0;
+    settings.trials = (uint)trials;
+    
+    [self discardResumeSnapshot];
+    LatencyHarness harness(self, settings);
+    harness.run();
+    
+    double frameTime = 1000.0 / self.frameInterval;
+    vector<double> frames, hostTimes, emulatedTimes;
+    NSMutableArray<NSDictionary *> *samples = [NSMutableArray array];
+    for (auto& trial : harness.trials) {
+        frames.append(trial.frames);
+        hostTimes.append(trial.hostTime);
+        emulatedTimes.append(trial.frames * frameTime);
+        [samples addObject:@{@"frames": @(trial.frames), @"hostMilliseconds": @(trial.hostTime)}];
+    }
+    NSDictionary *frameSummary = OEBSNESSummary(frames);
+    NSDictionary *emulatedSummary = OEBSNESSummary(emulatedTimes);
+    NSLog(@"Input latency: %lu samples, median %@ frames (%@ ms emulated), %u timeouts",
+        (unsigned long)samples.count, frameSummary[@"median"], emulatedSummary[@"median"], harness.timeouts);
+    
+    return @{
+        @"samples": samples,
+        @"timeouts": @(harness.timeouts),
+        @"frames": frameSummary,
+        @"hostMilliseconds": OEBSNESSummary(hostTimes),
+        @"emulatedMilliseconds": emulatedSummary};
+}
+
+
+#pragma mark - Load Profiling
+
+
+- (NSDictionary<NSString *, NSNumber *> *)loadProfile
+{
+    return OEBSNESLoadProfileDictionary(program->loadProfile);
+}
+
++ (void)setAggregatesLoadProfiles:(BOOL)flag
+{
+    LoadProfile::aggregate = flag;
+    LoadProfile::history.reset();
+}
+
++ (NSDictionary<NSString *, id> *)aggregateLoadProfile
+{
+    NSMutableDictionary<NSString *, id> *result = [NSMutableDictionary dictionary];
+    result[@"loads"] = @(LoadProfile::history.size());
+    if (!LoadProfile::history) return result;
+    NSMutableArray<NSDictionary<NSString *, NSNumber *> *> *profiles = [NSMutableArray array];
+    for (auto& profile : LoadProfile::history)
+        [profiles addObject:OEBSNESLoadProfileDictionary(profile)];
+    //summarize each phase across the loads
+    for (NSString *key in profiles.firstObject) {
+        vector<double> values;
+        for (NSDictionary<NSString *, NSNumber *> *profile in profiles)
+            values.append(profile[key].doubleValue);
+        result[key] = OEBSNESSummary(values);
+    }
+    return result;
+}
+
+
+#pragma mark - Netplay
+
+
+- (BOOL)startNetplayAsPlayer:(NSUInteger)player localPort:(uint16_t)localPort remoteHost:(NSString *)host remotePort:(uint16_t)remotePort
+{
+    NSAssert(player > 0 && player <= 2, @"too many players");
+    auto transport = NetplayUDPTransport::open(localPort, host.UTF8String, remotePort);
+    if (!transport) {
+        NSLog(@"Could not open netplay socket on port %u", localPort);
+        return NO;
+    }
+    [self stopNetplay];
+    [self discardResumeSnapshot];
+    _netplayError = nil;
+    netplay = new Netplay((uint)player - 1, transport);
+    return YES;
+}
+
+- (void)startLoopbackNetplayAsPlayer:(NSUInteger)player delay:(NSUInteger)frames
+{
+    NSAssert(player > 0 && player <= 2, @"too many players");
+    [self stopNetplay];
+    [self discardResumeSnapshot];
+    _netplayError = nil;
+    netplay = new Netplay((uint)player - 1, shared_pointer<NetplayTransport>{new NetplayLoopbackTransport((uint)frames)});
+}
+
+- (void)stopNetplay
+{
+    delete netplay;
+    netplay = nullptr;
+}
+
+
 #pragma mark - Video
 
 
@@ -0,0 +1,265 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <mutex>
+#include <unistd.h>
+#include <nall/decode/zip.hpp>
+#include <lzma/7z.h>
+#include <lzma/7zCrc.h>
+#include <lzma/Xz.h>
+#include <lzma/XzCrc64.h>
+
+/* Compressed ROMs.
+ *   ROMs can be loaded from zip, gzip, xz and 7z archives, which are told
+ * apart by their signature rather than by their extension. The archive is
+ * mapped and decompressed straight into the ROM image, without temporary
+ * files. xz uses the multithreaded decoder of the LZMA SDK, which splits the
+ * work between blocks when the archive has several. 7z archives are usually
+ * solid, and the LZMA SDK always decodes whole solid blocks, so the block
+ * holding the ROM is decoded in memory and the ROM copied out of it.
+ *   In archives holding several files, the first one with a known ROM
+ * extension is loaded, or else the largest one.
+ *   A ROM may happen to start with one of the signatures, so a file which
+ * fails to decompress is loaded as it is. */
+
+
+#pragma mark - Archives
+
+
+/* The largest ExHiROM is 8 MiB; this leaves room for a copier header and
+ * whatever dumps append to the ROM */
+static constexpr uint OEBSNESMaximumRomSize = 16 << 20;
+
+static auto OEBSNESIsRomName(string name) -> bool
+{
+    name.downcase();
+    for (auto extension : {".sfc", ".smc", ".swc", ".fig", ".bs", ".st"}) {
+        if (name.endsWith(extension)) return true;
+    }
+    return false;
+}
+
+static void *OEBSNESArchiveAlloc(ISzAllocPtr, size_t size) { return size ? malloc(size) : nullptr; }
+static void OEBSNESArchiveFree(ISzAllocPtr, void *address) { free(address); }
+static const ISzAlloc OEBSNESArchiveAllocator = { OEBSNESArchiveAlloc, OEBSNESArchiveFree };
+
+static auto OEBSNESUnzip(const uint8_t* data, uint size) -> shared_pointer<RomImage>
+{
+    Decode::ZIP archive;
+    if (!archive.open(data, size)) return {};
+    maybe<uint> selected;
+    for (uint n = 0; n < archive.file.size(); n++) {
+        if (OEBSNESIsRomName(archive.file[n].name)) { selected = n; break; }
+        if (!selected || archive.file[n].size > archive.file[selected()].size) selected = n;
+    }
+    if (!selected) return {};
+
+    auto& entry = archive.file[selected()];
+    if (entry.size > OEBSNESMaximumRomSize) return {};
+    auto image = RomImage::allocate(entry.size);
+    if (!image) return {};
+    if (entry.cmode == 0 && entry.csize == entry.size) {
+        memory::copy(image->data, entry.data, entry.size);
+        return image;
+    }
+    if (entry.cmode == 8 && Decode::inflate(image->data, entry.size, entry.data, entry.csize)) return image;
+    return {};
+}
+
+static auto OEBSNESGunzip(const uint8_t* data, uint size) -> shared_pointer<RomImage>
+{
+    //RFC 1952: the header is followed by raw deflate data, then CRC-32 and size
+    if (size < 18 || data[2] != 8) return {};
+    uint8_t flags = data[3];
+    uint offset = 10;
+    if (flags & 0x04) offset += 2 + (data[10] | data[11] << 8);       //FEXTRA
+    if (flags & 0x08) while (offset < size && data[offset++]);        //FNAME
+    if (flags & 0x10) while (offset < size && data[offset++]);        //FCOMMENT
+    if (flags & 0x02) offset += 2;                                    //FHCRC
+    if (offset + 8 > size) return {};
+
+    //the size is stored modulo 2^32, which is more than enough for a ROM;
+    //it is only a claim of the file, so it is checked before allocating
+    uint length = data[size - 4] | data[size - 3] << 8 | data[size - 2] << 16 | (uint)data[size - 1] << 24;
+    if (length == 0 || length > OEBSNESMaximumRomSize) return {};
+    auto image = RomImage::allocate(length);
+    if (!image) return {};
+    if (!Decode::inflate(image->data, length, data + offset, size - offset - 8)) return {};
+    return image;
+}
+
+struct OEBSNESMemoryInStream {
+    ISeqInStream vt;
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+};
+
+static SRes OEBSNESMemoryRead(const ISeqInStream *p, void *buf, size_t *size)
+{
+    auto stream = (OEBSNESMemoryInStream *)p;
+    size_t length = min(*size, stream->size - stream->offset);
+    memory::copy(buf, stream->data + stream->offset, length);
+    stream->offset += length;
+    *size = length;
+    return SZ_OK;
+}
+
+/* Decodes into a ROM image grown as the data comes */
+struct OEBSNESImageOutStream {
+    ISeqOutStream vt;
+    RomImage* image;
+    uint length;
+};
+
+static size_t OEBSNESImageWrite(const ISeqOutStream *p, const void *buf, size_t size)
+{
+    auto stream = (OEBSNESImageOutStream *)p;
+    if (size > OEBSNESMaximumRomSize - stream->length) return 0;
+    if (stream->length + size > stream->image->size) {
+        uint capacity = max(stream->length + (uint)size, stream->image->size * 2);
+        if (!stream->image->resize(capacity)) return 0;
+    }
+    memory::copy(stream->image->data + stream->length, buf, size);
+    stream->length += size;
+    return size;
+}
+
+static auto OEBSNESUnxz(const uint8_t* data, uint size) -> shared_pointer<RomImage>
+{
+    auto image = RomImage::allocate(max(size * 2, 1u << 20));
+    if (!image) return {};
+    CXzDecMtHandle decoder = XzDecMt_Create(&OEBSNESArchiveAllocator, &OEBSNESArchiveAllocator);
+    if (!decoder) return {};
+
+    CXzDecMtProps props;
+    XzDecMtProps_Init(&props);
+#ifndef _7ZIP_ST
+    props.numThreads = max(1l, sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+    OEBSNESMemoryInStream input = {{OEBSNESMemoryRead}, data, size, 0};
+    OEBSNESImageOutStream output = {{OEBSNESImageWrite}, image.data(), 0};
+    CXzStatInfo status;
+    int isMT = 0;
+    SRes result = XzDecMt_Decode(decoder, &props, nullptr, 1, &output.vt, &input.vt, &status, &isMT, nullptr);
+    XzDecMt_Destroy(decoder);
+    if (result != SZ_OK || !image->resize(output.length)) return {};
+    return image;
+}
+
+struct OEBSNESMemorySeekStream {
+    ISeekInStream vt;
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+};
+
+static SRes OEBSNESMemorySeekRead(const ISeekInStream *p, void *buf, size_t *size)
+{
+    auto stream = (OEBSNESMemorySeekStream *)p;
+    size_t length = min(*size, stream->size - stream->offset);
+    memory::copy(buf, stream->data + stream->offset, length);
+    stream->offset += length;
+    *size = length;
+    return SZ_OK;
+}
+
+static SRes OEBSNESMemorySeek(const ISeekInStream *p, Int64 *pos, ESzSeek origin)
+{
+    auto stream = (OEBSNESMemorySeekStream *)p;
+    Int64 base = origin == SZ_SEEK_SET ? 0 : origin == SZ_SEEK_CUR ? (Int64)stream->offset : (Int64)stream->size;
+    Int64 offset = base + *pos;
+    if (offset < 0 || offset > (Int64)stream->size) return SZ_ERROR_READ;
+    stream->offset = offset;
+    *pos = offset;
+    return SZ_OK;
+}
+
+static auto OEBSNESUn7z(const uint8_t* data, uint size) -> shared_pointer<RomImage>
+{
+    OEBSNESMemorySeekStream input = {{OEBSNESMemorySeekRead, OEBSNESMemorySeek}, data, size, 0};
+    CLookToRead2 look;
+    LookToRead2_CreateVTable(&look, False);
+    uint8_t buffer[1 << 14];
+    look.buf = buffer;
+    look.bufSize = sizeof(buffer);
+    look.realStream = &input.vt;
+    LookToRead2_Init(&look);
+
+    CSzArEx db;
+    SzArEx_Init(&db);
+    shared_pointer<RomImage> image;
+    if (SzArEx_Open(&db, &look.vt, &OEBSNESArchiveAllocator, &OEBSNESArchiveAllocator) == SZ_OK) {
+        maybe<uint> selected;
+        for (uint n = 0; n < db.NumFiles; n++) {
+            if (SzArEx_IsDir(&db, n)) continue;
+            //only the extension matters, which is ASCII
+            UInt16 name[512];
+            string ascii;
+            if (SzArEx_GetFileNameUtf16(&db, n, nullptr) <= 512) {
+                SzArEx_GetFileNameUtf16(&db, n, name);
+                for (uint c = 0; name[c]; c++) ascii.append((char)(name[c] < 0x80 ? name[c] : '_'));
+            }
+            if (OEBSNESIsRomName(ascii)) { selected = n; break; }
+            if (!selected || SzArEx_GetFileSize(&db, n) > SzArEx_GetFileSize(&db, selected())) selected = n;
+        }
+
+        UInt32 blockIndex = 0xffffffff;
+        Byte* block = nullptr;
+        size_t blockSize = 0, offset = 0, length = 0;
+        if (selected && SzArEx_Extract(&db, &look.vt, selected(), &blockIndex, &block, &blockSize,
+                &offset, &length, &OEBSNESArchiveAllocator, &OEBSNESArchiveAllocator) == SZ_OK
+            && length <= OEBSNESMaximumRomSize && (image = RomImage::allocate(length))) {
+            memory::copy(image->data, block + offset, length);
+        }
+        ISzAlloc_Free(&OEBSNESArchiveAllocator, block);
+    }
+    SzArEx_Free(&db, &OEBSNESArchiveAllocator);
+    return image;
+}
+
+/* Opens a ROM file, decompressing it if it is an archive */
+static auto OEBSNESOpenRom(string path) -> shared_pointer<RomImage>
+{
+    static std::once_flag tables;
+    std::call_once(tables, [] {
+        CrcGenerateTable();
+        Crc64GenerateTable();
+    });
+
+    auto image = RomImage::open(path);
+    if (!image || image->size < 6) return image;
+    const uint8_t* data = image->data;
+    uint size = image->size;
+    shared_pointer<RomImage> decoded;
+    if (!memcmp(data, "PK\x03\x04", 4)) decoded = OEBSNESUnzip(data, size);
+    else if (data[0] == 0x1f && data[1] == 0x8b) decoded = OEBSNESGunzip(data, size);
+    else if (!memcmp(data, "\xfd" "7zXZ\0", 6)) decoded = OEBSNESUnxz(data, size);
+    else if (!memcmp(data, "7z\xbc\xaf\x27\x1c", 6)) decoded = OEBSNESUn7z(data, size);
+    else return image;
+    //not an archive after all: a ROM starting with a signature by chance
+    return decoded ? decoded : image;
+}
@@ -0,0 +1,113 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+
+/* Firmware cache.
+ *   Coprocessor firmware (DSP-1, ST010, ST018...) is the same for every game
+ * using the chip, so the images are kept for the lifetime of the process,
+ * keyed by identifier, and shared read-only between game sessions. They are
+ * copied out of the file rather than kept mapped (they are 160 KiB at most),
+ * so a file changing on disk can never pull pages from under the core. An
+ * image is used again as long as the file keeps the same size and
+ * modification time, so switching between games using the same chip only
+ * costs a stat.
+ *   Each image is checked once when it is loaded: its size must be one the
+ * chip accepts, which is cheap and rules out most bad files. Its SHA-256 is
+ * logged, so a bad dump can be told apart from a missing one. */
+
+
+#pragma mark - Firmware Cache
+
+
+struct FirmwareCache {
+    static auto shared() -> FirmwareCache&;
+
+    /* The image of the firmware with the given identifier, loaded from
+     * `path` if it isn't cached or the file changed */
+    auto load(string identifier, string path) -> shared_pointer<RomImage>;
+
+private:
+    struct Entry {
+        shared_pointer<RomImage> image;
+        uint64_t size = 0;
+        uint64_t time = 0;
+    };
+
+    static auto valid(string identifier, uint size) -> bool;
+
+    std::mutex mutex;
+    std::map<string, Entry> entries;
+};
+
+auto FirmwareCache::shared() -> FirmwareCache&
+{
+    static FirmwareCache cache;
+    return cache;
+}
+
+/* Sizes of the firmware dumps, program and data ROMs together, as expected by
+ * Program::openRomSuperFamicom */
+auto FirmwareCache::valid(string identifier, uint size) -> bool
+{
+    if (identifier.beginsWith("dsp")) return size == 0x2000;   //uPD7725
+    if (identifier.beginsWith("st01")) {
+        if (identifier == "st018") return size == 0x28000;     //ARM6
+        return size == 0xd000;                                 //uPD96050
+    }
+    return size > 0;
+}
+
+auto FirmwareCache::load(string identifier, string path) -> shared_pointer<RomImage>
+{
+    struct stat info;
+    if (stat(path, &info) != 0) return {};
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = entries[identifier];
+    if (entry.image && entry.size == (uint64_t)info.st_size && entry.time == (uint64_t)info.st_mtime)
+        return entry.image;
+
+    entry = {};
+    auto mapping = RomImage::open(path);
+    if (!mapping) return {};
+    if (!valid(identifier, mapping->size)) {
+        NSLog(@"The firmware %s has an unexpected size (%u bytes)", path.begin(), mapping->size);
+        return {};
+    }
+    auto image = RomImage::allocate(mapping->size);
+    if (!image) return {};
+    memory::copy(image->data, mapping->data, mapping->size);
+    SHA256 hash;
+    hash.input(image->data, image->size);
+    NSLog(@"Loaded firmware %s (sha256=%s)", path.begin(), hash.digest().begin());
+    entry.image = image;
+    entry.size = info.st_size;
+    entry.time = info.st_mtime;
+    return image;
+}
@@ -0,0 +1,235 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+/* Game database index.
+ *   Super Famicom.bml holds thousands of games, and parsing it takes tens of
+ * milliseconds, all to find a single game. The first time it is needed, the
+ * database is converted to a binary index: a table of SHA-256 digests sorted
+ * for binary search, pointing to the BML manifest of each game. The index is
+ * memory-mapped, so a lookup only touches a few pages of it.
+ *   The index records the size and modification time of the database it was
+ * built from, and is rebuilt whenever they change. When it can't be written,
+ * the index that was just built is kept in memory instead, so the database
+ * is still parsed only once per process.
+ *   This file is plain C++ (with nall), so other tools can share it. */
+
+
+#pragma mark - Game Database
+
+
+struct GameDatabase {
+    GameDatabase() = default;
+    GameDatabase(const GameDatabase&) = delete;
+    auto operator=(const GameDatabase&) -> GameDatabase& = delete;
+    ~GameDatabase() { close(); }
+
+    /* Maps the index at `indexPath`, (re)building it from the BML database at
+     * `sourcePath` if it is missing or out of date */
+    auto open(string indexPath, string sourcePath) -> bool;
+    auto close() -> void;
+
+    /* The manifest of the game with the given SHA-256 (in hexadecimal), or an
+     * empty string if it isn't in the database */
+    auto find(string sha256) const -> string;
+
+    explicit operator bool() const { return count > 0; }
+
+private:
+    /* Format, integers are little-endian:
+     *   char[8] magic "BSNESDB1"
+     *   u64     size of the source database
+     *   u64     modification time of the source database
+     *   u32     game count
+     *   u32     reserved
+     *   entries, sorted by digest: u8[32] SHA-256, u32 offset, u32 length
+     *   manifests, as BML text; offsets are from the start of the file */
+    static constexpr uint HeaderSize = 32;
+    static constexpr uint EntrySize = 40;
+
+    static auto build(string sourcePath, uint64_t sourceSize, uint64_t sourceTime) -> vector<uint8_t>;
+    static auto write(string indexPath, const vector<uint8_t>& index) -> bool;
+    auto map(string indexPath, uint64_t sourceSize, uint64_t sourceTime) -> bool;
+
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    uint count = 0;
+    vector<uint8_t> memoryIndex;   //the index, when it isn't mapped from a file
+};
+
+static const char GameDatabaseMagic[8] = {'B', 'S', 'N', 'E', 'S', 'D', 'B', '1'};
+
+static auto GameDatabaseRead(const uint8_t* data, uint bytes) -> uint64_t
+{
+    uint64_t value = 0;
+    for (uint n = 0; n < bytes; n++) value |= (uint64_t)data[n] << (n * 8);
+    return value;
+}
+
+static auto GameDatabaseWrite(vector<uint8_t>& output, uint64_t value, uint bytes) -> void
+{
+    for (uint n = 0; n < bytes; n++) output.append(value >> (n * 8));
+}
+
+/* Converts a hexadecimal SHA-256 to its 32 bytes */
+static auto GameDatabaseDigest(string sha256, uint8_t digest[32]) -> bool
+{
+    if (sha256.size() != 64) return false;
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+    for (uint n = 0; n < 32; n++) {
+        int high = nibble(sha256[n * 2]), low = nibble(sha256[n * 2 + 1]);
+        if (high < 0 || low < 0) return false;
+        digest[n] = high << 4 | low;
+    }
+    return true;
+}
+
+auto GameDatabase::open(string indexPath, string sourcePath) -> bool
+{
+    close();
+    struct stat source;
+    if (stat(sourcePath, &source) != 0) return false;
+    if (map(indexPath, source.st_size, source.st_mtime)) return true;
+    auto index = build(sourcePath, source.st_size, source.st_mtime);
+    if (write(indexPath, index) && map(indexPath, source.st_size, source.st_mtime)) return true;
+
+    memoryIndex = move(index);
+    data = memoryIndex.data();
+    size = memoryIndex.size();
+    count = GameDatabaseRead(data + 24, 4);
+    return count > 0;
+}
+
+auto GameDatabase::close() -> void
+{
+    if (memoryIndex) memoryIndex.reset();
+    else if (data) munmap((void*)data, size);
+    data = nullptr;
+    size = 0;
+    count = 0;
+}
+
+auto GameDatabase::map(string indexPath, uint64_t sourceSize, uint64_t sourceTime) -> bool
+{
+    int fd = ::open(indexPath, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    void* map = fstat(fd, &info) == 0 && info.st_size >= HeaderSize
+        ? mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    data = (const uint8_t*)map;
+    size = info.st_size;
+    count = GameDatabaseRead(data + 24, 4);
+    bool valid = memcmp(data, GameDatabaseMagic, 8) == 0
+        && GameDatabaseRead(data + 8, 8) == sourceSize
+        && GameDatabaseRead(data + 16, 8) == sourceTime
+        && HeaderSize + (uint64_t)count * EntrySize <= size;
+    if (!valid) close();
+    return valid;
+}
+
+auto GameDatabase::build(string sourcePath, uint64_t sourceSize, uint64_t sourceTime) -> vector<uint8_t>
+{
+    struct Entry {
+        uint8_t digest[32];
+        string manifest;
+    };
+    vector<Entry> entries;
+    auto document = BML::unserialize(string::read(sourcePath));
+    for (auto node : document) {
+        if (node.name() != "game") continue;
+        Entry entry;
+        if (!GameDatabaseDigest(node["sha256"].text(), entry.digest)) continue;
+        entry.manifest = BML::serialize(node);
+        entries.append(entry);
+    }
+    entries.sort([](const Entry& lhs, const Entry& rhs) {
+        return memcmp(lhs.digest, rhs.digest, 32) < 0;
+    });
+
+    vector<uint8_t> output;
+    for (char c : GameDatabaseMagic) output.append(c);
+    GameDatabaseWrite(output, sourceSize, 8);
+    GameDatabaseWrite(output, sourceTime, 8);
+    GameDatabaseWrite(output, entries.size(), 4);
+    GameDatabaseWrite(output, 0, 4);
+    uint64_t offset = HeaderSize + (uint64_t)entries.size() * EntrySize;
+    for (auto& entry : entries) {
+        for (uint8_t byte : entry.digest) output.append(byte);
+        GameDatabaseWrite(output, offset, 4);
+        GameDatabaseWrite(output, entry.manifest.size(), 4);
+        offset += entry.manifest.size();
+    }
+    for (auto& entry : entries) {
+        for (uint n = 0; n < entry.manifest.size(); n++) output.append(entry.manifest[n]);
+    }
+    return output;
+}
+
+auto GameDatabase::write(string indexPath, const vector<uint8_t>& index) -> bool
+{
+    //several processes may build the index at once; whichever renames last wins
+    string temporary = {indexPath, ".", getpid(), ".tmp"};
+    if (!file::write(temporary, index)) return false;
+    if (rename(temporary, indexPath) != 0) {
+        file::remove(temporary);
+        return false;
+    }
+    return true;
+}
+
+auto GameDatabase::find(string sha256) const -> string
+{
+    uint8_t digest[32];
+    if (!count || !GameDatabaseDigest(sha256, digest)) return "";
+
+    uint low = 0, high = count;
+    while (low < high) {
+        uint middle = low + (high - low) / 2;
+        const uint8_t* entry = data + HeaderSize + (uint64_t)middle * EntrySize;
+        int order = memcmp(entry, digest, 32);
+        if (order < 0) { low = middle + 1; continue; }
+        if (order > 0) { high = middle; continue; }
+        uint64_t offset = GameDatabaseRead(entry + 32, 4);
+        uint64_t length = GameDatabaseRead(entry + 36, 4);
+        if (offset + length > size) return "";
+        string manifest;
+        manifest.resize(length);
+        memory::copy(manifest.get(), data + offset, length);
+        return manifest;
+    }
+    return "";
+}
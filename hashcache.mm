@@ -0,0 +1,159 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+
+/* ROM hash cache.
+ *   Hashing the ROM is the only part of loading that has to read the whole
+ * file. The cache remembers the SHA-256 of every ROM file it has seen, keyed
+ * by the identity of the file: path, size, modification time, inode and
+ * device. Any change to the file changes at least one of those, and the
+ * cached hash is then ignored. Nothing else is cached: the heuristics still
+ * run on every load to split the ROM in regions, and they only read its
+ * header.
+ *   The cache is a text file with one tab-separated line per ROM, which is
+ * only ever appended to; when a file is seen again after changing, the later
+ * line wins, and the file is compacted when it is loaded if it has grown to
+ * twice the size it needs.
+ *   This file is plain C++ (with nall), so other tools can share it. */
+
+
+#pragma mark - Hash Cache
+
+
+struct HashCache {
+    struct Identity {
+        uint64_t size = 0;
+        uint64_t time = 0;     //modification time, in nanoseconds
+        uint64_t inode = 0;
+        uint64_t device = 0;
+
+        auto operator==(const Identity& source) const -> bool {
+            return size == source.size && time == source.time && inode == source.inode && device == source.device;
+        }
+    };
+
+    struct Entry {
+        Identity identity;
+        string sha256;
+    };
+
+    static auto identify(string path) -> maybe<Identity>;
+
+    auto open(string cachePath) -> void;
+    auto find(string path, const Identity& identity) -> maybe<Entry>;
+    /* Returns false if the entry could not be appended to the file */
+    auto store(string path, const Entry& entry) -> bool;
+
+private:
+    static auto format(string path, const Entry& entry) -> string;
+
+    std::mutex mutex;
+    string cachePath;
+    std::map<string, Entry> entries;
+};
+
+auto HashCache::identify(string path) -> maybe<Identity>
+{
+    struct stat info;
+    if (stat(path, &info) != 0) return nothing;
+    Identity identity;
+    identity.size = info.st_size;
+#if defined(__APPLE__)
+    identity.time = (uint64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    identity.time = (uint64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+    identity.inode = info.st_ino;
+    identity.device = info.st_dev;
+    return identity;
+}
+
+/* One line: sha256, size, time, inode, device, path */
+auto HashCache::format(string path, const Entry& entry) -> string
+{
+    return {
+        entry.sha256, "\t",
+        entry.identity.size, "\t", entry.identity.time, "\t",
+        entry.identity.inode, "\t", entry.identity.device, "\t",
+        path, "\n"
+    };
+}
+
+auto HashCache::open(string path) -> void
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    cachePath = path;
+    entries.clear();
+
+    uint lines = 0;
+    for (auto& line : string::read(path).split("\n")) {
+        auto fields = line.split("\t", 5);
+        if (fields.size() != 6 || fields[0].size() != 64) continue;
+        Entry entry;
+        entry.sha256 = fields[0];
+        entry.identity.size = fields[1].natural();
+        entry.identity.time = fields[2].natural();
+        entry.identity.inode = fields[3].natural();
+        entry.identity.device = fields[4].natural();
+        entries[fields[5]] = entry;
+        lines++;
+    }
+
+    if (lines > 2 * entries.size() + 64) {
+        string contents;
+        for (auto& [key, value] : entries) contents.append(format(key, value));
+        string temporary = {path, ".", getpid(), ".tmp"};
+        if (file::write(temporary, contents) && rename(temporary, path) == 0) return;
+        file::remove(temporary);
+    }
+}
+
+auto HashCache::find(string path, const Identity& identity) -> maybe<Entry>
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(path);
+    if (entry != entries.end() && entry->second.identity == identity) return entry->second;
+    return nothing;
+}
+
+auto HashCache::store(string path, const Entry& entry) -> bool
+{
+    if (path.find("\n")) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[path] = entry;
+    if (!cachePath) return false;
+
+    //a single write with O_APPEND, so concurrent processes don't interleave lines
+    string line = format(path, entry);
+    int fd = ::open(cachePath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return false;
+    bool written = ::write(fd, line.data(), line.size()) == (ssize_t)line.size();
+    return ::close(fd) == 0 && written;
+}
@@ -0,0 +1,123 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Input-to-photon latency harness.
+ *   Each trial releases every button, lets the game settle, then pushes one
+ * button through -didPushSNESButton:forPlayer: and emulates frames until the
+ * output differs from the last frame before the press. The output is looked
+ * at either through one pixel or through a hash of the whole frame, directly
+ * on the frames produced by the core, so no video buffer is needed and the
+ * harness can run headless.
+ *   The harness expects a static screen which only changes in response to
+ * the input, like the ones of input test ROMs: any animation will be
+ * reported as a (short) latency. */
+
+
+#pragma mark - Latency Harness
+
+
+struct LatencyHarness {
+    struct Settings {
+        OESNESButton button = OESNESButtonA;
+        uint player = 1;
+        bool usePixel = false;   //otherwise the whole frame is hashed
+        uint x = 0, y = 0;
+        uint trials = 20;
+        uint settleFrames = 30;
+        uint timeoutFrames = 120;
+    };
+
+    struct Trial {
+        uint frames;         //emulated frames from the press to the change
+        double hostTime;     //milliseconds from the press to the end of that frame
+    };
+
+    LatencyHarness(BSNESGameCore *core, Settings settings) : core(core), settings(settings) {}
+
+    auto run() -> void;
+
+    BSNESGameCore *core;
+    Settings settings;
+    vector<Trial> trials;
+    uint timeouts = 0;
+
+private:
+    auto frame() -> uint64_t;
+    uint64_t signature = 0;
+};
+
+auto LatencyHarness::frame() -> uint64_t
+{
+    emulator->run();
+    return signature;
+}
+
+auto LatencyHarness::run() -> void
+{
+    program->videoProbe = [&](const uint16* data, uint pitch, uint width, uint height) {
+        pitch /= sizeof(uint16);
+        if (settings.usePixel) {
+            signature = settings.x < width && settings.y < height ? data[settings.y * pitch + settings.x] : 0;
+            return;
+        }
+        //FNV-1a over the visible pixels
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (uint y = 0; y < height; y++) {
+            for (uint x = 0; x < width; x++) {
+                uint16 color = data[y * pitch + x];
+                hash = (hash ^ (color & 0xff)) * 0x100000001b3ull;
+                hash = (hash ^ (color >> 8)) * 0x100000001b3ull;
+            }
+        }
+        signature = hash;
+    };
+    bool oldSkipVideo = program->skipVideo, oldSkipAudio = program->skipAudio;
+    program->skipVideo = true;
+    program->skipAudio = true;
+
+    for (uint trial = 0; trial < settings.trials; trial++) {
+        [core didReleaseSNESButton:settings.button forPlayer:settings.player];
+        uint64_t baseline = 0;
+        for (uint n = 0; n < max(1u, settings.settleFrames); n++)
+            baseline = frame();
+
+        uint64_t pressed = chrono::nanosecond();
+        [core didPushSNESButton:settings.button forPlayer:settings.player];
+        bool changed = false;
+        for (uint n = 1; n <= settings.timeoutFrames; n++) {
+            if (frame() == baseline) continue;
+            trials.append({n, (chrono::nanosecond() - pressed) / 1e6});
+            changed = true;
+            break;
+        }
+        if (!changed) timeouts++;
+    }
+    [core didReleaseSNESButton:settings.button forPlayer:settings.player];
+
+    program->skipVideo = oldSkipVideo;
+    program->skipAudio = oldSkipAudio;
+    program->videoProbe.reset();
+}
@@ -0,0 +1,230 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+/* Files handed to the core without going through buffered I/O.
+ *   vfs::fs::file reads through a small buffer with a system call on every
+ * seek, which is what the MSU-1 does all the time, and vfs::memory::file takes
+ * a copy of the data it is given. MappedFile maps the file instead, so opening
+ * even a large MSU-1 data pack is free and every access is a memory load.
+ * ViewFile serves memory which is already loaded (ROM images, firmware)
+ * without copying it.
+ *   ROM files themselves are mapped as well, and split into views of the
+ * mapping rather than copied into one buffer per region. */
+
+
+#pragma mark - Mapped Files
+
+
+struct MappedFile : vfs::file {
+    /* Read mode maps the file read-only. Write mode maps it shared and
+     * writable, sized to `size` bytes, and syncs it when the file is
+     * released; writes past that size still go to the file. Falls back to
+     * vfs::fs::file when the file cannot be mapped, or, in write mode, when
+     * the size isn't known or the file can't be resized to it. */
+    static auto open(string path, mode fileMode, uintmax size = 0) -> shared_pointer<vfs::file>;
+
+    ~MappedFile();
+
+    auto size() const -> uintmax override { return length; }
+    auto offset() const -> uintmax override { return position; }
+    auto seek(intmax offset, index mode) -> void override {
+        position = mode == index::absolute ? offset : position + offset;
+    }
+    auto read() -> uint8_t override { return position < length ? data[position++] : 0; }
+    auto write(uint8_t byte) -> void override {
+        if (writable && position < length) data[position] = byte;
+        else if (writable) pwrite(fd, &byte, 1, position);
+        position++;
+    }
+    auto flush() -> void override {
+        if (writable) msync(data, length, MS_SYNC);
+    }
+
+private:
+    MappedFile(uint8_t* data, uintmax length, int fd) : data(data), length(length), writable(fd >= 0), fd(fd) {}
+
+    uint8_t* data;
+    uintmax length;
+    uintmax position = 0;
+    bool writable;
+    int fd;   //kept open in write mode only
+};
+
+auto MappedFile::open(string path, mode fileMode, uintmax size) -> shared_pointer<vfs::file>
+{
+    bool writable = fileMode == mode::write;
+    int fd = ::open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) return vfs::fs::file::open(path, fileMode);
+
+    struct stat info;
+    uintmax length = 0;
+    if (writable) {
+        //a mapping can't grow, so it must cover everything that will be written
+        if (size && ftruncate(fd, size) == 0) length = size;
+    } else if (fstat(fd, &info) == 0) {
+        length = info.st_size;
+    }
+
+    void* map = length ? mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        return vfs::fs::file::open(path, fileMode);
+    }
+    if (!writable) {
+        //the mapping keeps its own reference to the file
+        ::close(fd);
+        fd = -1;
+        madvise(map, length, MADV_RANDOM);
+    }
+    return shared_pointer<vfs::file>{new MappedFile((uint8_t*)map, length, fd)};
+}
+
+MappedFile::~MappedFile()
+{
+    flush();
+    munmap(data, length);
+    if (fd >= 0) ::close(fd);
+}
+
+
+#pragma mark - Memory Views
+
+
+/* A read-only file over memory owned by someone else, which must outlive it */
+struct ViewFile : vfs::file {
+    static auto open(const uint8_t* data, uintmax length) -> shared_pointer<vfs::file> {
+        return shared_pointer<vfs::file>{new ViewFile(data, length)};
+    }
+
+    auto size() const -> uintmax override { return length; }
+    auto offset() const -> uintmax override { return position; }
+    auto seek(intmax offset, index mode) -> void override {
+        position = mode == index::absolute ? offset : position + offset;
+    }
+    auto read() -> uint8_t override { return position < length ? data[position++] : 0; }
+    auto write(uint8_t) -> void override { position++; }
+
+private:
+    ViewFile(const uint8_t* data, uintmax length) : data(data), length(length) {}
+
+    const uint8_t* data;
+    uintmax length;
+    uintmax position = 0;
+};
+
+
+#pragma mark - ROM Images
+
+
+/* A ROM file mapped copy-on-write: it can be patched in place, and only the
+ * pages which are actually modified get a private copy. When the file can't
+ * be mapped, it is read into memory instead.
+ *   Accessing a page after the file was truncated raises SIGBUS, so images
+ * are only kept while they are needed, not for the whole game session. */
+struct RomImage {
+    static auto open(string path) -> shared_pointer<RomImage>;
+    /* an image in memory, to be filled by the caller; it can be resized */
+    static auto allocate(uint size) -> shared_pointer<RomImage>;
+    auto resize(uint size) -> bool;
+
+    ~RomImage() {
+        if (mapped) munmap(data, size);
+        else free(data);
+    }
+
+    uint8_t* data = nullptr;
+    uint size = 0;
+
+private:
+    bool mapped = false;
+};
+
+auto RomImage::allocate(uint size) -> shared_pointer<RomImage>
+{
+    shared_pointer<RomImage> image{new RomImage};
+    if (!image->resize(size)) return {};
+    return image;
+}
+
+auto RomImage::resize(uint newSize) -> bool
+{
+    if (mapped) return false;
+    auto newData = (uint8_t*)realloc(data, max(newSize, 1u));
+    if (!newData) return false;
+    data = newData;
+    size = newSize;
+    return true;
+}
+
+auto RomImage::open(string path) -> shared_pointer<RomImage>
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return {};
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0 || info.st_size > UINT_MAX) {
+        ::close(fd);
+        return {};
+    }
+
+    shared_pointer<RomImage> image{new RomImage};
+    image->size = info.st_size;
+    void* map = mmap(nullptr, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        image->data = (uint8_t*)map;
+        image->mapped = true;
+    } else {
+        image->data = (uint8_t*)malloc(image->size);
+        if (!image->data || pread(fd, image->data, image->size, 0) != (ssize_t)image->size) image.reset();
+    }
+    ::close(fd);
+    return image;
+}
+
+/* A region of a ROM image, or of another buffer owned elsewhere */
+struct RomView {
+    RomView() = default;
+    RomView(const uint8_t* data, uint size) : pointer(data), length(size) {}
+
+    auto data() const -> const uint8_t* { return pointer; }
+    auto size() const -> uint { return length; }
+
+private:
+    const uint8_t* pointer = nullptr;
+    uint length = 0;
+};
+
+/* A vector borrowing memory it doesn't own, for the interfaces which take
+ * vectors. The memory must not be resized through it. */
+struct VectorAlias {
+    VectorAlias(uint8_t* data, uint size) { vector.acquire(data, size, size); }
+    ~VectorAlias() { vector.release(); }
+
+    nall::vector<uint8_t> vector;
+};
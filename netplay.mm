@@ -0,0 +1,517 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Rollback netplay between two instances of the core, one per controller port.
+ *   Every frame the local input is sent to the peer, and the input of the
+ * remote player is predicted by repeating the last one received. When the
+ * actual remote input for an already emulated frame arrives and differs from
+ * the prediction, the emulation is rolled back to the state saved before that
+ * frame and the following frames are emulated again without any output.
+ *   Both peers must start from the same state, so the system is powered on
+ * again (without RAM entropy) when a session starts, and the peers check that
+ * they run the same ROM on the same version of the core, from the same state,
+ * before exchanging any input. A session which can no longer stay in sync
+ * ends with an error instead of going on. */
+
+
+#pragma mark - Packets
+
+
+/* no datagram is larger than this */
+static constexpr uint NetplayMaxDatagram = 256;
+
+/* Handshake, sent every frame until the peer's one arrives:
+ *   u32 magic, u8 reply, char[64] ROM SHA-256, char[8] serializer version,
+ *   char[64] SHA-256 of the state the session starts from
+ * Each one received is answered with a reply, which is never answered, so a
+ * peer which missed ours gets it again without the two bouncing forever. */
+struct NetplayHello {
+    static constexpr uint32_t Magic = 0x484e5342;  //"BSNH"
+    static constexpr uint Size = 4 + 1 + 64 + 8 + 64;
+
+    bool reply = false;
+    string sha256;
+    string version;
+    string state;
+
+    auto encode(uint8_t *data) const -> uint {
+        memory::fill(data, Size);
+        for (uint n = 0; n < 4; n++) data[n] = Magic >> (n * 8);
+        data[4] = reply;
+        memory::copy(data + 5, sha256.data(), min(sha256.size(), 64));
+        memory::copy(data + 69, version.data(), min(version.size(), 8));
+        memory::copy(data + 77, state.data(), min(state.size(), 64));
+        return Size;
+    }
+
+    auto decode(const uint8_t *data, uint size) -> bool {
+        if (size != Size) return false;
+        uint32_t magic = 0;
+        for (uint n = 0; n < 4; n++) magic |= (uint32_t)data[n] << (n * 8);
+        if (magic != Magic) return false;
+        auto text = [&](uint offset, uint length) -> string {
+            string value;
+            for (uint n = 0; n < length && data[offset + n]; n++) value.append((char)data[offset + n]);
+            return value;
+        };
+        reply = data[4];
+        sha256 = text(5, 64);
+        version = text(69, 8);
+        state = text(77, 64);
+        return true;
+    }
+};
+
+/* Wire format, all little-endian:
+ *   u32 magic, u32 frame, u32 ack, u8 count, u16 input[count]
+ * `input[i]` is the sender's input for frame `frame + i`; `ack` is the first
+ * frame of the receiver's input that the sender has not received yet.
+ * Inputs are resent until acknowledged, so lost datagrams are harmless. */
+struct NetplayPacket {
+    static constexpr uint32_t Magic = 0x504e5342;  //"BSNP"
+    static constexpr uint MaxInputs = 32;
+    static constexpr uint MaxSize = 13 + 2 * MaxInputs;
+
+    uint32_t frame = 0;
+    uint32_t ack = 0;
+    uint count = 0;
+    uint16_t input[MaxInputs] = {};
+
+    auto encode(uint8_t *data) const -> uint {
+        uint8_t *p = data;
+        auto put = [&](uint64_t value, uint bytes) {
+            for (uint n = 0; n < bytes; n++) *p++ = value >> (n * 8);
+        };
+        put(Magic, 4);
+        put(frame, 4);
+        put(ack, 4);
+        put(count, 1);
+        for (uint n = 0; n < count; n++) put(input[n], 2);
+        return (uint)(p - data);
+    }
+
+    auto decode(const uint8_t *data, uint size) -> bool {
+        if (size < 13) return false;
+        const uint8_t *p = data;
+        auto get = [&](uint bytes) -> uint32_t {
+            uint32_t value = 0;
+            for (uint n = 0; n < bytes; n++) value |= (uint32_t)*p++ << (n * 8);
+            return value;
+        };
+        if (get(4) != Magic) return false;
+        frame = get(4);
+        ack = get(4);
+        count = get(1);
+        if (count > MaxInputs || size < 13 + 2 * count) return false;
+        for (uint n = 0; n < count; n++) input[n] = get(2);
+        return true;
+    }
+};
+
+
+#pragma mark - Transports
+
+
+struct NetplayTransport {
+    virtual ~NetplayTransport() = default;
+
+    /* both calls must never block: datagrams may be lost, and receive()
+     * returns 0 when nothing is pending */
+    virtual auto send(const uint8_t *data, uint size) -> void = 0;
+    virtual auto receive(uint8_t *data, uint capacity) -> uint = 0;
+};
+
+/* Datagram transport, mostly meant to connect two OpenEmu instances running
+ * on the same machine through localhost. The socket only listens on the
+ * loopback interface, unless the peer is on another host. */
+struct NetplayUDPTransport : NetplayTransport {
+    ~NetplayUDPTransport() {
+        if (fd >= 0) close(fd);
+    }
+
+    static auto open(uint16_t localPort, string remoteHost, uint16_t remotePort) -> shared_pointer<NetplayUDPTransport> {
+        shared_pointer<NetplayUDPTransport> instance{new NetplayUDPTransport};
+
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo *remote = nullptr;
+        if (getaddrinfo(remoteHost.data(), string{remotePort}.data(), &hints, &remote) || !remote)
+            return {};
+        memory::copy(&instance->remote, remote->ai_addr, sizeof(sockaddr_in));
+        freeaddrinfo(remote);
+        bool loopback = (ntohl(instance->remote.sin_addr.s_addr) >> 24) == 127;
+
+        instance->fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (instance->fd < 0) return {};
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(loopback ? INADDR_LOOPBACK : INADDR_ANY);
+        local.sin_port = htons(localPort);
+        if (bind(instance->fd, (sockaddr *)&local, sizeof(local)) < 0) return {};
+        fcntl(instance->fd, F_SETFL, fcntl(instance->fd, F_GETFL) | O_NONBLOCK);
+        return instance;
+    }
+
+    auto send(const uint8_t *data, uint size) -> void override {
+        sendto(fd, data, size, 0, (sockaddr *)&remote, sizeof(remote));
+    }
+
+    auto receive(uint8_t *data, uint capacity) -> uint override {
+        while (true) {
+            sockaddr_in from = {};
+            socklen_t fromSize = sizeof(from);
+            ssize_t size = recvfrom(fd, data, capacity, 0, (sockaddr *)&from, &fromSize);
+            if (size <= 0) return 0;
+            //ignore anything not coming from the peer
+            if (from.sin_addr.s_addr != remote.sin_addr.s_addr || from.sin_port != remote.sin_port) continue;
+            return (uint)size;
+        }
+    }
+
+private:
+    int fd = -1;
+    sockaddr_in remote = {};
+};
+
+/* In-process stand-in for a remote player, for testing without a network.
+ * The fake peer answers the handshake with a copy of the local one, plays
+ * back the local player's own inputs, and only confirms them `delay` frames
+ * late. Every change of the local input is therefore
+ * mispredicted and rolled back, which exercises the engine like a real peer
+ * with `delay` frames of latency would. */
+struct NetplayLoopbackTransport : NetplayTransport {
+    NetplayLoopbackTransport(uint delay) : delay(delay) {}
+
+    auto send(const uint8_t *data, uint size) -> void override {
+        NetplayHello hello;
+        if (hello.decode(data, size)) {
+            if (hello.reply) return;
+            hello.reply = true;
+            pending.length = hello.encode(pending.data);
+            return;
+        }
+
+        NetplayPacket packet;
+        if (!packet.decode(data, size)) return;
+        for (uint n = 0; n < packet.count; n++) {
+            uint32_t frame = packet.frame + n;
+            if (frame != received) continue;
+            history[frame % HistorySize] = packet.input[n];
+            received++;
+        }
+        //one packet is sent per emulated frame, so this is the peer's clock
+        elapsed++;
+
+        NetplayPacket reply;
+        uint32_t confirmed = elapsed > delay ? min(elapsed - delay, received) : 0;
+        reply.frame = max(packet.ack, confirmed - min(confirmed, HistorySize));
+        reply.ack = received;
+        reply.count = min(confirmed - min(confirmed, reply.frame), NetplayPacket::MaxInputs);
+        for (uint n = 0; n < reply.count; n++)
+            reply.input[n] = history[(reply.frame + n) % HistorySize];
+        pending.length = reply.encode(pending.data);
+    }
+
+    auto receive(uint8_t *data, uint capacity) -> uint override {
+        uint size = min(pending.length, capacity);
+        memory::copy(data, pending.data, size);
+        pending.length = 0;
+        return size;
+    }
+
+private:
+    static constexpr uint HistorySize = 64;
+    uint delay;
+    uint32_t elapsed = 0;
+    uint32_t received = 0;
+    uint16_t history[HistorySize] = {};
+    struct {
+        uint8_t data[NetplayMaxDatagram];
+        uint length = 0;
+    } pending;
+};
+
+
+#pragma mark - Rollback Engine
+
+
+struct Netplay {
+    /* Maximum amount of frames emulated ahead of the last confirmed remote
+     * input. All of them may need to be emulated again within a single host
+     * frame, so this also bounds the worst case cost of a rollback: the
+     * emulation stalls rather than getting further ahead. */
+    static constexpr uint MaxRollback = 8;
+    static constexpr uint HistorySize = 64;
+
+    Netplay(uint localPort, shared_pointer<NetplayTransport> transport);
+    ~Netplay();
+
+    auto runFrame() -> bool;
+    auto failed() const -> bool { return phase == Phase::Failed; }
+
+    string error;                 //why the session failed
+    uint localPort;
+    uint remotePort;
+    shared_pointer<NetplayTransport> transport;
+
+    uint32_t frame = 0;           //next frame to be emulated
+    uint32_t confirmedFrame = 0;  //the remote input of every frame before this one is known, never past `frame`
+    uint32_t peerAck = 0;         //the peer knows our input of every frame before this one
+
+    uint rollbacks = 0;
+    uint stalls = 0;
+    uint maxResimulated = 0;
+
+private:
+    enum class Phase : uint { Handshake, Running, Failed };
+    Phase phase = Phase::Handshake;
+    NetplayHello hello;           //ours
+
+    struct Frame {
+        uint32_t number = ~0u;
+        uint16_t input[2] = {};
+        bool confirmed = false;   //input[remotePort] comes from the peer
+        vector<uint8_t> state;    //state at the beginning of this frame, allocated once
+    };
+    Frame history[HistorySize];
+    uint32_t mispredictedFrame = ~0u;
+
+    auto fail(string reason) -> void;
+    auto greet(bool reply) -> void;
+    auto receive(const NetplayHello& remote) -> void;
+    auto entry(uint32_t number) -> Frame&;
+    auto prediction() -> uint16_t;
+    auto poll() -> void;
+    auto sendInputs() -> void;
+    auto rollback() -> bool;
+    auto emulate(Frame& f, bool output) -> void;
+};
+
+/* Owned by BSNESGameCore, only exists during a netplay session */
+static Netplay *netplay = nullptr;
+
+Netplay::Netplay(uint localPort, shared_pointer<NetplayTransport> transport) :
+    localPort(localPort), remotePort(!localPort), transport(transport)
+{
+    emulator->configure("Hacks/Entropy", "None");
+    emulator->power();
+    program->inputOverride.enabled = true;
+
+    hello.sha256 = program->superFamicom.sha256;
+    hello.version = Emulator::SerializerVersion;
+    serializer s = emulator->serialize(false);
+    SHA256 hash;
+    hash.input(s.data(), s.size());
+    hello.state = hash.digest();
+}
+
+Netplay::~Netplay()
+{
+    program->inputOverride.enabled = false;
+    //restores the RAM entropy setting of the game
+    program->hackCompatibility();
+    if (rollbacks)
+        NSLog(@"Netplay: %u rollbacks, at most %u frames resimulated, %u stalls", rollbacks, maxResimulated, stalls);
+}
+
+auto Netplay::fail(string reason) -> void
+{
+    if (phase == Phase::Failed) return;
+    phase = Phase::Failed;
+    error = reason;
+    NSLog(@"Netplay: %s", reason.data());
+}
+
+auto Netplay::greet(bool reply) -> void
+{
+    hello.reply = reply;
+    uint8_t data[NetplayMaxDatagram];
+    transport->send(data, hello.encode(data));
+}
+
+auto Netplay::receive(const NetplayHello& remote) -> void
+{
+    if (remote.sha256 != hello.sha256)
+        return fail("the peer is running a different ROM");
+    if (remote.version != hello.version)
+        return fail({"the peer is running version ", remote.version, " of the core, not ", hello.version});
+    if (remote.state != hello.state)
+        return fail("the peer did not start from the same state");
+    if (!remote.reply) greet(true);
+    if (phase == Phase::Handshake) phase = Phase::Running;
+}
+
+auto Netplay::entry(uint32_t number) -> Frame&
+{
+    Frame& f = history[number % HistorySize];
+    if (f.number != number) {
+        f.number = number;
+        f.input[0] = f.input[1] = 0;
+        f.confirmed = false;
+    }
+    return f;
+}
+
+auto Netplay::prediction() -> uint16_t
+{
+    //the last remote input known for a frame that was already emulated
+    uint32_t known = min(confirmedFrame, frame);
+    if (known == 0) return 0;
+    return entry(known - 1).input[remotePort];
+}
+
+auto Netplay::poll() -> void
+{
+    uint8_t data[NetplayMaxDatagram];
+    while (uint size = transport->receive(data, sizeof(data))) {
+        NetplayHello remote;
+        if (remote.decode(data, size)) {
+            receive(remote);
+            continue;
+        }
+        //inputs are only meaningful once both peers agree on the game
+        if (phase != Phase::Running) continue;
+        NetplayPacket packet;
+        if (!packet.decode(data, size)) continue;
+        peerAck = max(peerAck, min(packet.ack, frame));
+
+        for (uint n = 0; n < packet.count; n++) {
+            uint32_t number = packet.frame + n;
+            //already confirmed, or too far in the future to be stored without
+            //overwriting frames that are still needed
+            if (number < confirmedFrame || number >= frame + HistorySize / 2) continue;
+            Frame& f = entry(number);
+            if (f.confirmed) continue;
+            if (number < frame && f.input[remotePort] != packet.input[n])
+                mispredictedFrame = min(mispredictedFrame, number);
+            f.input[remotePort] = packet.input[n];
+            f.confirmed = true;
+        }
+    }
+    //inputs received ahead of time are kept, and confirm their frame once it
+    //has been emulated
+    while (confirmedFrame < frame && entry(confirmedFrame).confirmed)
+        confirmedFrame++;
+}
+
+auto Netplay::sendInputs() -> void
+{
+    NetplayPacket packet;
+    packet.ack = confirmedFrame;
+    packet.frame = peerAck;
+    packet.count = min(frame - packet.frame, NetplayPacket::MaxInputs);
+    for (uint n = 0; n < packet.count; n++)
+        packet.input[n] = entry(packet.frame + n).input[localPort];
+
+    uint8_t data[NetplayPacket::MaxSize];
+    transport->send(data, packet.encode(data));
+}
+
+auto Netplay::emulate(Frame& f, bool output) -> void
+{
+    //the core always serializes into a new buffer, which is freed right away
+    //so the allocator hands the same memory back on the next frame
+    serializer s = emulator->serialize(false);
+    if (f.state.size() != s.size()) f.state.resize(s.size());
+    memory::copy(f.state.data(), s.data(), s.size());
+    program->inputOverride.buttons[0] = f.input[0];
+    program->inputOverride.buttons[1] = f.input[1];
+    program->skipVideo = !output;
+    program->skipAudio = !output;
+    emulator->run();
+    program->skipVideo = false;
+    program->skipAudio = false;
+}
+
+auto Netplay::rollback() -> bool
+{
+    uint32_t start = mispredictedFrame;
+    mispredictedFrame = ~0u;
+    //inputs are only accepted from confirmedFrame on, and runFrame() stalls
+    //before getting more than MaxRollback frames ahead of it, so this would
+    //be a bug; starting later would go on from a wrong state
+    if (frame - start > MaxRollback) {
+        fail({"a rollback of ", frame - start, " frames exceeds the budget of ", MaxRollback});
+        return false;
+    }
+
+    Frame& first = entry(start);
+    if (!program->unserialize(first.state.data(), first.state.size())) {
+        fail({"the state of frame ", start, " could not be restored"});
+        return false;
+    }
+
+    uint64_t begin = chrono::nanosecond();
+    for (uint32_t number = start; number < frame; number++) {
+        Frame& f = entry(number);
+        if (!f.confirmed) f.input[remotePort] = prediction();
+        emulate(f, false);
+    }
+    uint64_t elapsed = chrono::nanosecond() - begin;
+
+    uint resimulated = frame - start;
+    rollbacks++;
+    maxResimulated = max(maxResimulated, resimulated);
+    if (elapsed > 1000000000 / 60)
+        NSLog(@"Netplay: resimulating %u frames took %.2f ms", resimulated, elapsed / 1e6);
+    return true;
+}
+
+/* Emulates the next frame, rolling back first if needed. Returns false when
+ * the handshake is not done yet or the peer is too far behind; in that case
+ * the frame is not emulated and the call should simply be repeated on the
+ * next host frame. Also returns false once the session has failed(), which
+ * it never recovers from. */
+auto Netplay::runFrame() -> bool
+{
+    if (failed()) return false;
+    poll();
+    if (phase == Phase::Handshake) greet(false);
+    if (phase != Phase::Running) return false;
+    if (mispredictedFrame < frame && !rollback()) return false;
+
+    if (confirmedFrame < frame && frame - confirmedFrame >= MaxRollback) {
+        stalls++;
+        sendInputs();
+        return false;
+    }
+
+    Frame& f = entry(frame);
+    f.input[localPort] = program->padState(0);
+    if (!f.confirmed) f.input[remotePort] = prediction();
+    emulate(f, true);
+    frame++;
+
+    sendInputs();
+    return true;
+}
@@ -0,0 +1,249 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Soft patching.
+ *   A patch next to the ROM, with the same name and the extension .bps, .ups
+ * or .ips (in that order of preference), is applied when the game is loaded.
+ * The ROM is mapped copy-on-write, so patches which only overwrite bytes are
+ * applied in place, and only the pages they touch get a private copy: the
+ * rest of the ROM stays shared with the file. A new image is only built when
+ * the patch changes the size of the ROM, or is a BPS patch which copies data
+ * around.
+ *   Like the ROM, the patch applies to the file as it is, including any
+ * copier header. */
+
+
+#pragma mark - Patches
+
+
+struct Patch {
+    /* Applies the patch in `patch` to `image`, which may be replaced */
+    static auto applyIPS(shared_pointer<RomImage>& image, const uint8_t* patch, uint size) -> bool;
+    static auto applyUPS(shared_pointer<RomImage>& image, const uint8_t* patch, uint size) -> bool;
+    static auto applyBPS(shared_pointer<RomImage>& image, const uint8_t* patch, uint size) -> bool;
+
+private:
+    static auto resize(shared_pointer<RomImage>& image, uint size) -> bool;
+    static auto crc32(const uint8_t* data, uint size) -> uint32_t;
+    static auto read32(const uint8_t* data) -> uint32_t {
+        return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+    }
+};
+
+/* Resizes the image, copying it out of the mapping when it is mapped */
+auto Patch::resize(shared_pointer<RomImage>& image, uint size) -> bool
+{
+    if (image->size == size) return true;
+    uint previous = image->size;
+    if (image->resize(size)) {
+        if (size > previous) memory::fill(image->data + previous, size - previous);
+        return true;
+    }
+    auto copy = RomImage::allocate(size);
+    if (!copy) return false;
+    memory::copy(copy->data, image->data, min(size, image->size));
+    if (size > image->size) memory::fill(copy->data + image->size, size - image->size);
+    image = copy;
+    return true;
+}
+
+auto Patch::crc32(const uint8_t* data, uint size) -> uint32_t
+{
+    return Hash::CRC32(array_view<uint8_t>{data, size}).value();
+}
+
+auto Patch::applyIPS(shared_pointer<RomImage>& image, const uint8_t* patch, uint size) -> bool
+{
+    if (size < 8 || memcmp(patch, "PATCH", 5) != 0) return false;
+
+    //a first pass checks the patch and finds the size of the result, the
+    //second applies the records
+    for (uint pass = 0; pass < 2; pass++) {
+        uint offset = 5, end = image->size;
+        maybe<uint> truncate;
+        while (true) {
+            if (offset + 3 > size) return false;
+            uint address = patch[offset] << 16 | patch[offset + 1] << 8 | patch[offset + 2];
+            offset += 3;
+            if (address == 0x454f46) {  //"EOF", optionally followed by the truncated size
+                if (offset + 3 <= size) truncate = patch[offset] << 16 | patch[offset + 1] << 8 | patch[offset + 2];
+                break;
+            }
+            if (offset + 2 > size) return false;
+            uint length = patch[offset] << 8 | patch[offset + 1];
+            offset += 2;
+            bool rle = length == 0;
+            if (rle) {
+                if (offset + 3 > size) return false;
+                length = patch[offset] << 8 | patch[offset + 1];
+                offset += 2;
+            }
+            if (pass == 0) {
+                end = max(end, address + length);
+            } else if (rle) {
+                memory::fill(image->data + address, length, patch[offset]);
+            } else {
+                memory::copy(image->data + address, patch + offset, length);
+            }
+            offset += rle ? 1 : length;
+            if (offset > size) return false;
+        }
+        if (pass == 0 && end > image->size && !resize(image, end)) return false;
+        if (pass == 1 && truncate && truncate() < image->size && !resize(image, truncate())) return false;
+    }
+    return true;
+}
+
+/* BPS and UPS number encoding */
+static auto OEBSNESPatchNumber(const uint8_t* patch, uint size, uint& offset) -> uint64_t
+{
+    uint64_t data = 0, shift = 1;
+    while (offset < size && shift < (1ull << 56)) {
+        uint8_t x = patch[offset++];
+        data += (x & 0x7f) * shift;
+        if (x & 0x80) break;
+        shift <<= 7;
+        data += shift;
+    }
+    return data;
+}
+
+auto Patch::applyUPS(shared_pointer<RomImage>& image, const uint8_t* patch, uint size) -> bool
+{
+    if (size < 16 || memcmp(patch, "UPS1", 4) != 0) return false;
+    uint offset = 4;
+    uint64_t sourceSize = OEBSNESPatchNumber(patch, size, offset);
+    uint64_t targetSize = OEBSNESPatchNumber(patch, size, offset);
+    if (sourceSize != image->size || targetSize > UINT_MAX) return false;
+    if (crc32(image->data, image->size) != read32(patch + size - 12)) return false;
+    if (!resize(image, targetSize)) return false;
+
+    //XOR runs, each ending with a zero byte, separated by skipped lengths
+    uint64_t address = 0;
+    while (offset < size - 12) {
+        address += OEBSNESPatchNumber(patch, size, offset);
+        while (offset < size - 12) {
+            uint8_t x = patch[offset++];
+            if (address < targetSize) image->data[address] ^= x;
+            address++;
+            if (!x) break;
+        }
+    }
+    return crc32(image->data, image->size) == read32(patch + size - 8);
+}
+
+auto Patch::applyBPS(shared_pointer<RomImage>& image, const uint8_t* patch, uint size) -> bool
+{
+    if (size < 16 || memcmp(patch, "BPS1", 4) != 0) return false;
+    uint offset = 4;
+    uint64_t sourceSize = OEBSNESPatchNumber(patch, size, offset);
+    uint64_t targetSize = OEBSNESPatchNumber(patch, size, offset);
+    uint64_t metadataSize = OEBSNESPatchNumber(patch, size, offset);
+    offset += metadataSize;
+    if (sourceSize != image->size || targetSize > UINT_MAX || offset > size - 12) return false;
+    if (crc32(image->data, image->size) != read32(patch + size - 12)) return false;
+    const uint actions = offset;
+
+    //patches made only of source and target reads can be applied in place;
+    //malformed ones are not, and are rejected by the checks below
+    bool inPlace = targetSize == sourceSize;
+    uint64_t scanned = 0;
+    for (offset = actions; inPlace && offset < size - 12;) {
+        uint64_t data = OEBSNESPatchNumber(patch, size, offset);
+        uint64_t length = (data >> 2) + 1;
+        uint command = data & 3;
+        if (command >= 2 || scanned + length > targetSize) inPlace = false;
+        else if (command == 1 && (uint64_t)offset + length > size - 12) inPlace = false;
+        else if (command == 1) offset += length;
+        scanned += length;
+    }
+
+    const uint8_t* source = image->data;
+    shared_pointer<RomImage> target = image;
+    if (!inPlace && !(target = RomImage::allocate(targetSize))) return false;
+
+    uint64_t output = 0, sourceRelative = 0, targetRelative = 0;
+    for (offset = actions; offset < size - 12;) {
+        uint64_t data = OEBSNESPatchNumber(patch, size, offset);
+        uint64_t length = (data >> 2) + 1;
+        if (output + length > targetSize) return false;
+        switch (data & 3) {
+        case 0:  //source read
+            if (output + length > sourceSize) return false;
+            if (!inPlace) memory::copy(target->data + output, source + output, length);
+            break;
+        case 1:  //target read
+            if (offset + length > size - 12) return false;
+            memory::copy(target->data + output, patch + offset, length);
+            offset += length;
+            break;
+        case 2: case 3: {  //source copy, target copy
+            uint64_t relative = OEBSNESPatchNumber(patch, size, offset);
+            uint64_t& position = (data & 3) == 2 ? sourceRelative : targetRelative;
+            position += (relative & 1 ? -1 : 1) * (int64_t)(relative >> 1);
+            uint64_t limit = (data & 3) == 2 ? sourceSize : output;
+            const uint8_t* from = (data & 3) == 2 ? source : target->data;
+            //target copies may overlap their own output, so copy byte by byte
+            for (uint64_t n = 0; n < length; n++) {
+                if (position >= limit && (data & 3) == 2) return false;
+                if ((data & 3) == 3 && position >= output + n) return false;
+                target->data[output + n] = from[position++];
+            }
+            break;
+        }
+        }
+        output += length;
+    }
+    if (output != targetSize || crc32(target->data, targetSize) != read32(patch + size - 8)) return false;
+    image = target;
+    return true;
+}
+
+/* Applies the patch found next to the ROM, if any. Returns whether the image
+ * was patched. A patch failing its checksums may have been partly applied,
+ * in which case the ROM is opened again. */
+static auto OEBSNESApplySoftPatch(shared_pointer<RomImage>& image, string location) -> bool
+{
+    string base = Location::notsuffix(location);
+    for (auto extension : {".bps", ".ups", ".ips"}) {
+        string path = {base, extension};
+        if (!file::exists(path)) continue;
+        auto patch = RomImage::open(path);
+        if (!patch) continue;
+        bool applied = false;
+        if (string{extension} == ".bps") applied = Patch::applyBPS(image, patch->data, patch->size);
+        if (string{extension} == ".ups") applied = Patch::applyUPS(image, patch->data, patch->size);
+        if (string{extension} == ".ips") applied = Patch::applyIPS(image, patch->data, patch->size);
+        if (applied) {
+            NSLog(@"Applied patch %s", path.begin());
+            return true;
+        }
+        NSLog(@"The patch %s does not apply to this ROM", path.begin());
+        image = OEBSNESOpenRom(location);
+        if (!image) return false;
+    }
+    return false;
+}
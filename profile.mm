@@ -0,0 +1,130 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Load profiling.
+ *   Every game load is split in phases, timed with the monotonic clock. A phase
+ * does not include the phases nested in it: the ROM is read and the firmware
+ * is loaded from within emulator->load(), which is only charged for the rest,
+ * so the phases add up to the total. The ROM is hashed on another thread
+ * while the heuristics run; the hash phase is the time the load spent waiting
+ * for it, and the time the hash itself took is reported on its own.
+ *   The profile of the last load is logged as a single line of key=value
+ * pairs and can be queried. For batch runs, the profiles of every load of the
+ * process can also be kept and summarized. */
+
+
+#pragma mark - Load Profile
+
+
+struct LoadProfile {
+    enum Phase : uint {
+        FileRead,           //mapping or decompressing the ROM, applying patches
+        HeaderStrip,
+        Heuristics,
+        Hash,               //hash cache lookup, and waiting for the hash
+        DatabaseLookup,
+        ManifestParse,
+        FirmwareLoad,
+        EmulatorLoad,       //everything else done by emulator->load()
+        HackCompatibility,
+        Power,
+        PhaseCount
+    };
+    static const char* const names[PhaseCount];
+
+    /* Times the enclosing block as the given phase */
+    struct Scope {
+        Scope(LoadProfile& profile, Phase phase);
+        ~Scope();
+
+        LoadProfile& profile;
+        const Phase phase;
+        Scope* const parent;
+        const uint64_t start;
+        uint64_t nested = 0;   //time spent in the scopes inside this one
+    };
+
+    auto description() const -> string;
+
+    /* all in milliseconds */
+    double durations[PhaseCount] = {};
+    double hashing = 0;     //time taken by the hash on its own thread
+    double total = 0;
+
+    /* every profile recorded since aggregation was enabled; only touched from
+     * the thread that loads games */
+    static bool aggregate;
+    static vector<LoadProfile> history;
+
+private:
+    Scope* current = nullptr;
+};
+
+const char* const LoadProfile::names[PhaseCount] = {
+    "read", "header", "heuristics", "sha256", "database", "manifest",
+    "firmware", "load", "hacks", "power"
+};
+bool LoadProfile::aggregate = false;
+vector<LoadProfile> LoadProfile::history;
+
+LoadProfile::Scope::Scope(LoadProfile& profile, Phase phase)
+: profile(profile), phase(phase), parent(profile.current), start(chrono::nanosecond())
+{
+    profile.current = this;
+}
+
+LoadProfile::Scope::~Scope()
+{
+    uint64_t elapsed = chrono::nanosecond() - start;
+    profile.durations[phase] += (elapsed - nested) / 1e6;
+    if (parent) parent->nested += elapsed;
+    profile.current = parent;
+}
+
+auto LoadProfile::description() const -> string
+{
+    auto milliseconds = [](double value) -> string {
+        char text[32];
+        snprintf(text, sizeof(text), "%.3fms", value);
+        return text;
+    };
+    string line = {"total=", milliseconds(total)};
+    for (uint phase = 0; phase < PhaseCount; phase++)
+        line.append(" ", names[phase], "=", milliseconds(durations[phase]));
+    line.append(" sha256-thread=", milliseconds(hashing));
+    return line;
+}
+
+/* The phases of a profile and its totals, in milliseconds, by name */
+static NSDictionary<NSString *, NSNumber *> *OEBSNESLoadProfileDictionary(const LoadProfile& profile)
+{
+    NSMutableDictionary<NSString *, NSNumber *> *result = [NSMutableDictionary dictionary];
+    for (uint phase = 0; phase < LoadProfile::PhaseCount; phase++)
+        result[@(LoadProfile::names[phase])] = @(profile.durations[phase]);
+    result[@"sha256-thread"] = @(profile.hashing);
+    result[@"total"] = @(profile.total);
+    return result;
+}
@@ -6,6 +6,16 @@ using namespace nall;
 #include <heuristics/heuristics.cpp>
 #include <heuristics/super-famicom.cpp>
 
+#include "mapping.mm"
+#include "archive.mm"
+#include "patch.mm"
+#include "gamedb.mm"
+#include "sha256.mm"
+#include "hashcache.mm"
+#include "firmware.mm"
+#include "summary.mm"
+#include "profile.mm"
+
 /* This file is mostly lifted from bsnes/target-libretro/program.cpp, which
 * in turn was mostly lifted from bsnes/target-bsnes/program/program.cpp and
 * its plethora of includes.
@@ -34,6 +44,23 @@ static Program *program = nullptr;
 
 #pragma mark - Platform Object
 
+/* A file which keeps in memory whatever the core writes to it */
+struct CaptureFile : vfs::file {
+    auto size() const -> uintmax override { return data.size(); }
+    auto offset() const -> uintmax override { return position; }
+    auto seek(intmax offset, index mode) -> void override {
+        position = mode == index::absolute ? offset : position + offset;
+    }
+    auto read() -> uint8_t override { return position < data.size() ? data[position++] : 0; }
+    auto write(uint8_t byte) -> void override {
+        if (position >= data.size()) data.resize(position + 1);
+        data[position++] = byte;
+    }
+
+    vector<uint8_t> data;
+    uintmax position = 0;
+};
+
 struct Program : Emulator::Platform {
     Program(BSNESGameCore *oeCore);
     ~Program() {};
@@ -45,11 +72,14 @@ struct Program : Emulator::Platform {
     auto inputPoll(uint port, uint device, uint input) -> int16 override;
     auto inputRumble(uint port, uint device, uint input, bool enable) -> void override;
     
+    auto padState(uint port) -> uint16_t;
+    
     auto load() -> void;
-    auto loadFile(string location) -> vector<uint8_t>;
     auto loadSuperFamicom(string location) -> bool;
 
     auto save() -> void;
+    auto saveRamPath() -> string;
+    auto captureSaveRam() -> vector<uint8_t>;
 
     auto openRomSuperFamicom(string name, vfs::file::mode mode) -> shared_pointer<vfs::file>;
     auto loadSuperFamicomFirmware(string fwname) -> void;
@@ -59,11 +89,64 @@ struct Program : Emulator::Platform {
     
     auto updateVideoPalette() -> void;
     
+    auto stateSize() -> uint;
+    auto serializeInto(uint8_t* buffer, uint capacity) -> uint;
+    auto unserialize(const uint8_t* data, uint size) -> bool;
+    
+    auto advance(uint frames, uint flags, function<void ()> frameDone = {}) -> double;
+    auto setFastForward(bool enabled) -> void;
+    
     __weak BSNESGameCore *oeCore;
     string base_name;
     
     bool overscan = false;
     
+    /* the size of a save state does not change while a game is loaded */
+    uint cachedStateSize = 0;
+    
+    /* index of Super Famicom.bml, opened on the first load; not retried if
+     * that fails, since every attempt parses the whole database */
+    GameDatabase gameDatabase;
+    bool gameDatabaseOpened = false;
+    
+    /* hashes of the ROM files loaded before, opened on the first load */
+    HashCache hashCache;
+    bool hashCacheOpened = false;
+    
+    /* while set, save.ram is written here instead of to the disk */
+    shared_pointer<vfs::file> saveRamCapture;
+    
+    /* scratch space for states which have to be decoded before loading */
+    vector<uint8_t> stateBuffer;
+    
+    /* When set, the emulated frames and samples are still produced by the
+     * core, but they are not converted nor handed to OpenEmu. */
+    bool skipVideo = false;
+    bool skipAudio = false;
+    
+    struct FastForward {
+        bool enabled = false;
+        uint speed = 4;          //emulated frames per -executeFrame
+        uint videoInterval = 4;  //convert one frame out of this many
+        uint audioInterval = 0;  //keep one sample out of this many; 0 mutes
+        bool speedHacks = true;
+        
+        uint frameCounter = 0;
+        uint sampleCounter = 0;
+        bool savedDelayedSync = false;
+    } fastForward;
+    
+    /* Called with every frame produced by the core, before any conversion.
+     * Used by the latency harness to look at the output headlessly. */
+    function<void (const uint16* data, uint pitch, uint width, uint height)> videoProbe;
+    
+    /* When enabled, the controllers read these button states (packed like
+     * padState() does) instead of the ones pushed by OpenEmu. */
+    struct InputOverride {
+        bool enabled = false;
+        uint16_t buttons[2] = {};
+    } inputOverride;
+    
     maybe<string> lastFailedBiosLoad;
     bool failedLoadingAtLeastOneRequiredFile;
 
@@ -82,11 +165,16 @@ public:
     struct SuperFamicom : Game {
         string title;
         string region;
-        vector<uint8_t> program;
-        vector<uint8_t> data;
-        vector<uint8_t> expansion;
-        vector<uint8_t> firmware;
+        string sha256;
+        shared_pointer<RomImage> image;     //the ROM file, which the regions below point into; only kept while loading
+        shared_pointer<RomImage> firmwareImage;  //firmware from the BIOS directory, a copy shared with the cache
+        RomView program;
+        RomView data;
+        RomView expansion;
+        RomView firmware;
     } superFamicom;
+
+    LoadProfile loadProfile;   //of the last game loaded
     
     uint32_t palette[0x8000];
 };
@@ -104,6 +192,20 @@ auto Program::save() -> void
     emulator->save();
 }
 
+/* Returns the current contents of the battery-backed RAM (including SA-1
+ * BW-RAM and SuperFX RAM, which the core also saves as save.ram), without
+ * writing anything to the disk. Empty if the game has no such memory. */
+auto Program::captureSaveRam() -> vector<uint8_t>
+{
+    if(!emulator->loaded()) return {};
+    auto capture = new CaptureFile;
+    saveRamCapture = shared_pointer<vfs::file>{capture};
+    emulator->save();
+    vector<uint8_t> data = move(capture->data);
+    saveRamCapture.reset();
+    return data;
+}
+
 auto Program::open(uint id, string name, vfs::file::mode mode, bool required) -> shared_pointer<vfs::file>
 {
     shared_pointer<vfs::file> result;
@@ -111,18 +213,22 @@ auto Program::open(uint id, string name, vfs::file::mode mode, bool required) ->
     if ((name == "ipl.rom" || name == "boards.bml") && mode == vfs::file::mode::read) {
         NSString *nsname = [NSString stringWithUTF8String:name.begin()];
         NSURL *url = [[NSBundle bundleForClass:[oeCore class]] URLForResource:nsname withExtension:nil];
-        return vfs::fs::file::open(url.fileSystemRepresentation, mode);
+        return MappedFile::open(url.fileSystemRepresentation, mode);
+    }
+
+    if (saveRamCapture && name == "save.ram" && mode == vfs::file::mode::write) {
+        return saveRamCapture;
     }
 
     if (id == ::SuperFamicom::ID::SuperFamicom) { //Super Famicom
         if (name == "manifest.bml" && mode == vfs::file::mode::read) {
-            result = vfs::memory::file::open(superFamicom.manifest.data<uint8_t>(), superFamicom.manifest.size());
+            result = ViewFile::open(superFamicom.manifest.data<uint8_t>(), superFamicom.manifest.size());
         } else if (name == "program.rom" && mode == vfs::file::mode::read) {
-            result = vfs::memory::file::open(superFamicom.program.data(), superFamicom.program.size());
+            result = ViewFile::open(superFamicom.program.data(), superFamicom.program.size());
         } else if (name == "data.rom" && mode == vfs::file::mode::read) {
-            result = vfs::memory::file::open(superFamicom.data.data(), superFamicom.data.size());
+            result = ViewFile::open(superFamicom.data.data(), superFamicom.data.size());
         } else if (name == "expansion.rom" && mode == vfs::file::mode::read) {
-            result = vfs::memory::file::open(superFamicom.expansion.data(), superFamicom.expansion.size());
+            result = ViewFile::open(superFamicom.expansion.data(), superFamicom.expansion.size());
         } else {
             result = openRomSuperFamicom(name, mode);
         }
@@ -138,15 +244,41 @@ auto Program::open(uint id, string name, vfs::file::mode mode, bool required) ->
 
 auto Program::load() -> void
 {
+    uint64_t start = chrono::nanosecond();
+    loadProfile = {};
     failedLoadingAtLeastOneRequiredFile = false;
     lastFailedBiosLoad.reset();
+    cachedStateSize = 0;
+    stateBuffer.reset();
     
-    emulator->unload();
-    emulator->load();
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::EmulatorLoad);
+        emulator->unload();
+        emulator->load();
+    }
+    //the core copied every region it uses, so the mapping is released now:
+    //had it stayed, the ROM file being truncated on the disk would crash the
+    //core on its next access to a page that wasn't read yet
+    superFamicom.program = {};
+    superFamicom.data = {};
+    superFamicom.expansion = {};
+    superFamicom.firmware = {};
+    superFamicom.image.reset();
+    superFamicom.firmwareImage.reset();
+
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::HackCompatibility);
+        hackCompatibility();
+    }
 
-    hackCompatibility();
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::Power);
+        emulator->power();
+    }
 
-    emulator->power();
+    loadProfile.total = (chrono::nanosecond() - start) / 1e6;
+    if (LoadProfile::aggregate) LoadProfile::history.append(loadProfile);
+    NSLog(@"Load profile: %s", loadProfile.description().begin());
 }
 
 auto Program::load(uint id, string name, string type, vector<string> options) -> Emulator::Platform::Load
@@ -163,6 +295,14 @@ auto Program::load(uint id, string name, string type, vector<string> options) ->
 
 auto Program::videoFrame(const uint16* data, uint pitch, uint width, uint height, uint scale) -> void
 {
+    if (videoProbe) videoProbe(data, pitch, width, height);
+    if (skipVideo) return;
+    //the last frame of each batch is shown, so the picture is never behind
+    if (fastForward.enabled) {
+        if (++fastForward.frameCounter < fastForward.videoInterval) return;
+        fastForward.frameCounter = 0;
+    }
+    
     BSNESGameCore *core = oeCore;
     uint32_t *outBuffer = core->videoBuffer;
     
@@ -199,36 +339,56 @@ static int16_t d2i16(double v)
 
 auto Program::audioFrame(const double* samples, uint channels) -> void
 {
+    if (skipAudio) return;
+    if (fastForward.enabled) {
+        if (!fastForward.audioInterval) return;
+        if (fastForward.sampleCounter++ % fastForward.audioInterval) return;
+    }
+    
     int16_t data[2];
     data[0] = d2i16(samples[0]);
     data[1] = d2i16(samples[1]);
     [[oeCore audioBufferAtIndex:0] write:data maxLength:sizeof(data)];
 }
 
+/* see bsnes/sfc/interface/interface.cpp for the ordering */
+static const OESNESButton buttonMap[OESNESButtonCount] = {
+    OESNESButtonUp,
+    OESNESButtonDown,
+    OESNESButtonLeft,
+    OESNESButtonRight,
+    OESNESButtonB,
+    OESNESButtonA,
+    OESNESButtonY,
+    OESNESButtonX,
+    OESNESButtonTriggerLeft,
+    OESNESButtonTriggerRight,
+    OESNESButtonSelect,
+    OESNESButtonStart};
+
 auto Program::inputPoll(uint port, uint device, uint input) -> int16
 {
     if (device != ::SuperFamicom::ID::Device::Gamepad)
         return 0;
+    if (inputOverride.enabled)
+        return (inputOverride.buttons[port] >> input) & 1;
     BSNESGameCore *core = oeCore;
-    
-    /* see bsnes/sfc/interface/interface.cpp for the ordering */
-    const OESNESButton buttonMap[OESNESButtonCount] = {
-        OESNESButtonUp,
-        OESNESButtonDown,
-        OESNESButtonLeft,
-        OESNESButtonRight,
-        OESNESButtonB,
-        OESNESButtonA,
-        OESNESButtonY,
-        OESNESButtonX,
-        OESNESButtonTriggerLeft,
-        OESNESButtonTriggerRight,
-        OESNESButtonSelect,
-        OESNESButtonStart};
-        
     return core->pad[port][buttonMap[input]];
 }
 
+/* Packs the buttons currently held on a port, one bit per input in the same
+ * order used by inputPoll() */
+auto Program::padState(uint port) -> uint16_t
+{
+    BSNESGameCore *core = oeCore;
+    uint16_t state = 0;
+    for (uint input = 0; input < OESNESButtonCount; input++) {
+        if (core->pad[port][buttonMap[input]])
+            state |= 1 << input;
+    }
+    return state;
+}
+
 auto Program::inputRumble(uint port, uint device, uint input, bool enable) -> void
 {
 }
@@ -236,26 +396,26 @@ auto Program::inputRumble(uint port, uint device, uint input, bool enable) -> vo
 auto Program::openRomSuperFamicom(string name, vfs::file::mode mode) -> shared_pointer<vfs::file>
 {
     if(name == "program.rom" && mode == vfs::file::mode::read) {
-        return vfs::memory::file::open(superFamicom.program.data(), superFamicom.program.size());
+        return ViewFile::open(superFamicom.program.data(), superFamicom.program.size());
     }
     
     if(name == "data.rom" && mode == vfs::file::mode::read) {
-        return vfs::memory::file::open(superFamicom.data.data(), superFamicom.data.size());
+        return ViewFile::open(superFamicom.data.data(), superFamicom.data.size());
     }
     
     if(name == "expansion.rom" && mode == vfs::file::mode::read) {
-        return vfs::memory::file::open(superFamicom.expansion.data(), superFamicom.expansion.size());
+        return ViewFile::open(superFamicom.expansion.data(), superFamicom.expansion.size());
     }
 
     if(name == "msu1/data.rom")
     {
-        return vfs::fs::file::open({Location::notsuffix(superFamicom.location), ".msu"}, mode);
+        return MappedFile::open({Location::notsuffix(superFamicom.location), ".msu"}, mode);
     }
 
     if(name.match("msu1/track*.pcm"))
     {
         name.trimLeft("msu1/track", 1L);
-        return vfs::fs::file::open({Location::notsuffix(superFamicom.location), name}, mode);
+        return MappedFile::open({Location::notsuffix(superFamicom.location), name}, mode);
     }
 
     /* DSP3.rom */
@@ -266,12 +426,12 @@ auto Program::openRomSuperFamicom(string name, vfs::file::mode mode) -> shared_p
     }
     if(name == "upd7725.program.rom" && mode == vfs::file::mode::read) {
       if(superFamicom.firmware.size() == 0x2000) {
-        return vfs::memory::file::open(&superFamicom.firmware.data()[0x0000], 0x1800);
+        return ViewFile::open(&superFamicom.firmware.data()[0x0000], 0x1800);
       }
     }
     if(name == "upd7725.data.rom" && mode == vfs::file::mode::read) {
       if(superFamicom.firmware.size() == 0x2000) {
-        return vfs::memory::file::open(&superFamicom.firmware.data()[0x1800], 0x0800);
+        return ViewFile::open(&superFamicom.firmware.data()[0x1800], 0x0800);
       }
     }
     
@@ -283,12 +443,12 @@ auto Program::openRomSuperFamicom(string name, vfs::file::mode mode) -> shared_p
     }
     if(name == "arm6.program.rom" && mode == vfs::file::mode::read) {
         if(superFamicom.firmware.size() == 0x28000) {
-            return vfs::memory::file::open(&superFamicom.firmware.data()[0x00000], 0x20000);
+            return ViewFile::open(&superFamicom.firmware.data()[0x00000], 0x20000);
         }
     }
     if(name == "arm6.data.rom" && mode == vfs::file::mode::read) {
         if(superFamicom.firmware.size() == 0x28000) {
-            return vfs::memory::file::open(&superFamicom.firmware.data()[0x20000], 0x08000);
+            return ViewFile::open(&superFamicom.firmware.data()[0x20000], 0x08000);
         }
     }
     
@@ -300,21 +460,20 @@ auto Program::openRomSuperFamicom(string name, vfs::file::mode mode) -> shared_p
     }
     if(name == "upd96050.program.rom" && mode == vfs::file::mode::read) {
       if(superFamicom.firmware.size() == 0xd000) {
-        return vfs::memory::file::open(&superFamicom.firmware.data()[0x0000], 0xc000);
+        return ViewFile::open(&superFamicom.firmware.data()[0x0000], 0xc000);
       }
     }
     if(name == "upd96050.data.rom" && mode == vfs::file::mode::read) {
       if(superFamicom.firmware.size() == 0xd000) {
-        return vfs::memory::file::open(&superFamicom.firmware.data()[0xc000], 0x1000);
+        return ViewFile::open(&superFamicom.firmware.data()[0xc000], 0x1000);
       }
     }
     
     if(name == "save.ram") {
         NSURL *gameFn = [NSURL fileURLWithFileSystemRepresentation:base_name.begin() isDirectory:NO relativeToURL:nil];
         NSString *gameBasename = [gameFn lastPathComponent];
-        NSString *gameBasenameNoExt = [gameBasename stringByDeletingPathExtension];
         NSURL *batterySavesDir = [NSURL fileURLWithPath:oeCore.batterySavesDirectoryPath];
-        NSURL *savePath = [batterySavesDir URLByAppendingPathComponent:[gameBasenameNoExt stringByAppendingPathExtension:@"srm"]];
+        NSURL *savePath = [NSURL fileURLWithFileSystemRepresentation:saveRamPath().begin() isDirectory:NO relativeToURL:nil];
         
         if (!nall::file::exists(savePath.fileSystemRepresentation)) {
             /* attempt importing an old save file from the Higan core */
@@ -330,88 +489,153 @@ auto Program::openRomSuperFamicom(string name, vfs::file::mode mode) -> shared_p
             NSLog(@"Opening save.ram file %@", savePath.path);
         }
         
-        return vfs::fs::file::open(savePath.fileSystemRepresentation, mode);
+        uintmax size = superFamicom.document["game/board/memory(type=RAM,content=Save)/size"].natural();
+        return MappedFile::open(savePath.fileSystemRepresentation, mode, size);
     }
 
     return {};
 }
 
+/* The .srm file in OpenEmu's battery saves directory */
+auto Program::saveRamPath() -> string
+{
+    NSURL *gameFn = [NSURL fileURLWithFileSystemRepresentation:base_name.begin() isDirectory:NO relativeToURL:nil];
+    NSString *gameBasenameNoExt = [[gameFn lastPathComponent] stringByDeletingPathExtension];
+    NSURL *batterySavesDir = [NSURL fileURLWithPath:oeCore.batterySavesDirectoryPath];
+    NSURL *savePath = [batterySavesDir URLByAppendingPathComponent:[gameBasenameNoExt stringByAppendingPathExtension:@"srm"]];
+    return savePath.fileSystemRepresentation;
+}
+
 auto Program::loadSuperFamicomFirmware(string fwname) -> void
 {
     string biosfn = string(fwname).append(".rom");
     string path = oeCore.biosDirectoryPath.fileSystemRepresentation;
     path.append("/", biosfn);
     NSLog(@"Attempting to load BIOS file %s", path.begin());
-    superFamicom.firmware = file::read(path);
+    LoadProfile::Scope scope(loadProfile, LoadProfile::FirmwareLoad);
+    superFamicom.firmwareImage = FirmwareCache::shared().load(fwname, path);
+    if (auto& image = superFamicom.firmwareImage)
+        superFamicom.firmware = {image->data, image->size};
     if (superFamicom.firmware.size() == 0)
         lastFailedBiosLoad = biosfn;
 }
 
-auto Program::loadFile(string location) -> vector<uint8_t>
-{
-    return file::read(location);
-}
-
 auto Program::loadSuperFamicom(string location) -> bool
 {
     string manifest;
-    vector<uint8_t> rom;
-    rom = loadFile(location);
-
-    if(rom.size() < 0x8000) return false;
+    superFamicom.program = {};
+    superFamicom.data = {};
+    superFamicom.expansion = {};
+    superFamicom.firmware = {};
+    superFamicom.firmwareImage.reset();
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::FileRead);
+        superFamicom.image = OEBSNESOpenRom(location);
+        if(superFamicom.image) superFamicom.patched = OEBSNESApplySoftPatch(superFamicom.image, location);
+    }
+    if(!superFamicom.image) return false;
 
-    //assume ROM and IPS agree on whether a copier header is present
-    //superFamicom.patched = applyPatchIPS(rom, location);
-    if((rom.size() & 0x7fff) == 512) {
-        //remove copier header
-        memory::move(&rom[0], &rom[512], (uint)(rom.size() - 512));
-        rom.resize(rom.size() - 512);
+    //assume ROM and patch agree on whether a copier header is present;
+    //the copier header is skipped rather than moved out of the way
+    uint8_t* romData = superFamicom.image->data;
+    uint romSize = superFamicom.image->size;
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::HeaderStrip);
+        if((romSize & 0x7fff) == 512) {
+            romData += 512;
+            romSize -= 512;
+        }
     }
+    if(romSize < 0x8000) return false;
 
-    auto heuristics = Heuristics::SuperFamicom(rom, location);
-    auto sha256 = Hash::SHA256(rom).digest();
+    VectorAlias alias(romData, romSize);
+    auto& rom = alias.vector;
+
+    maybe<HashCache::Identity> identity;
+    maybe<HashCache::Entry> cached;
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::Hash);
+        if(!hashCacheOpened) {
+            NSString *supportDirectory = oeCore.supportDirectoryPath;
+            [[NSFileManager defaultManager] createDirectoryAtPath:supportDirectory withIntermediateDirectories:YES attributes:nil error:NULL];
+            NSString *cache = [supportDirectory stringByAppendingPathComponent:@"ROM Hashes.txt"];
+            hashCache.open(cache.fileSystemRepresentation);
+            hashCacheOpened = true;
+        }
+        //the cache knows the hash of the file, not of the patched image
+        if(!superFamicom.patched) identity = HashCache::identify(location);
+        if(identity) cached = hashCache.find(location, identity());
+    }
+
+    //the hash and the heuristics only read the ROM, so they run side by side
+    __block string sha256 = cached ? cached().sha256 : string{};
+    __block double hashingTime = 0;
+    dispatch_group_t hashing = dispatch_group_create();
+    if(!cached) {
+        dispatch_group_async(hashing, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+            uint64_t start = chrono::nanosecond();
+            SHA256 hash;
+            hash.input(romData, romSize);
+            sha256 = hash.digest();
+            hashingTime = (chrono::nanosecond() - start) / 1e6;
+        });
+    }
+    auto heuristics = [&] {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::Heuristics);
+        return Heuristics::SuperFamicom(rom, location);
+    }();
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::Hash);
+        dispatch_group_wait(hashing, DISPATCH_TIME_FOREVER);
+        loadProfile.hashing = hashingTime;
+        if(!cached && identity) {
+            if(!hashCache.store(location, {identity(), sha256}))
+                NSLog(@"Could not store the hash of %s in the hash cache", location.begin());
+        }
+    }
     superFamicom.title = heuristics.title();
     superFamicom.region = heuristics.videoRegion();
+    superFamicom.sha256 = sha256;
     NSURL *dburl = [[NSBundle bundleForClass:[oeCore class]] URLForResource:@"Super Famicom" withExtension:@"bml"];
-    if(auto document = BML::unserialize(string::read(dburl.fileSystemRepresentation))) {
-      if(auto game = document[{"game(sha256=", sha256, ")"}]) {
-        manifest = BML::serialize(game);
-        //the internal ROM header title is not present in the database, but is needed for internal core overrides
-        manifest.append("  title: ", superFamicom.title, "\n");
-        superFamicom.verified = true;
-        NSLog(@"The game being loaded (sha256=%s, title=%s) is VERIFIED", sha256.begin(), superFamicom.title.begin());
-      } else {
-        NSLog(@"The game being loaded (sha256=%s, title=%s) is NOT VERIFIED", sha256.begin(), superFamicom.title.begin());
-      }
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::DatabaseLookup);
+        if(!gameDatabaseOpened) {
+          gameDatabaseOpened = true;
+          //the support directory was created along with the hash cache
+          NSString *index = [oeCore.supportDirectoryPath stringByAppendingPathComponent:@"Super Famicom.index"];
+          gameDatabase.open(index.fileSystemRepresentation, dburl.fileSystemRepresentation);
+        }
+        manifest = gameDatabase.find(sha256);
+    }
+    if(manifest) {
+      //the internal ROM header title is not present in the database, but is needed for internal core overrides
+      manifest.append("  title: ", superFamicom.title, "\n");
+      superFamicom.verified = true;
+      NSLog(@"The game being loaded (sha256=%s, title=%s) is VERIFIED", sha256.begin(), superFamicom.title.begin());
+    } else {
+      NSLog(@"The game being loaded (sha256=%s, title=%s) is NOT VERIFIED", sha256.begin(), superFamicom.title.begin());
     }
-    superFamicom.manifest = manifest ? manifest : heuristics.manifest();
     hackPatchMemory(rom);
-    superFamicom.document = BML::unserialize(superFamicom.manifest);
+    {
+        LoadProfile::Scope scope(loadProfile, LoadProfile::ManifestParse);
+        superFamicom.manifest = manifest ? manifest : heuristics.manifest();
+        superFamicom.document = BML::unserialize(superFamicom.manifest);
+    }
     superFamicom.location = location;
     
     NSLog(@"Region of game: %s", superFamicom.region.begin());
 
     uint offset = 0;
-    if(auto size = heuristics.programRomSize()) {
-        superFamicom.program.resize(size);
-        memory::copy(&superFamicom.program[0], &rom[offset], size);
-        offset += size;
-    }
-    if(auto size = heuristics.dataRomSize()) {
-        superFamicom.data.resize(size);
-        memory::copy(&superFamicom.data[0], &rom[offset], size);
-        offset += size;
-    }
-    if(auto size = heuristics.expansionRomSize()) {
-        superFamicom.expansion.resize(size);
-        memory::copy(&superFamicom.expansion[0], &rom[offset], size);
-        offset += size;
-    }
-    if(auto size = heuristics.firmwareRomSize()) {
-        superFamicom.firmware.resize(size);
-        memory::copy(&superFamicom.firmware[0], &rom[offset], size);
+    auto region = [&](uint size) -> RomView {
+        size = min(size, romSize - min(offset, romSize));
+        RomView view{romData + offset, size};
         offset += size;
-    }
+        return view;
+    };
+    if(auto size = heuristics.programRomSize()) superFamicom.program = region(size);
+    if(auto size = heuristics.dataRomSize()) superFamicom.data = region(size);
+    if(auto size = heuristics.expansionRomSize()) superFamicom.expansion = region(size);
+    if(auto size = heuristics.firmwareRomSize()) superFamicom.firmware = region(size);
     return true;
 }
 
@@ -511,6 +735,86 @@ auto Program::hackPatchMemory(vector<uint8_t>& data) -> void
     }
 }
 
+auto Program::stateSize() -> uint
+{
+    if (!cachedStateSize && emulator->loaded())
+        cachedStateSize = emulator->serialize().size();
+    return cachedStateSize;
+}
+
+/* Serializes the state straight into a buffer owned by the caller, which can
+ * be reused across snapshots. Returns the amount of bytes written, or 0 if the
+ * buffer is too small (see stateSize()).
+ *   The serializer is still allocated by the core, as nall::serializer always
+ * owns its storage; this only spares the extra copy into a fresh allocation. */
+auto Program::serializeInto(uint8_t* buffer, uint capacity) -> uint
+{
+    if (!emulator->loaded()) return 0;
+    serializer s = emulator->serialize();
+    cachedStateSize = s.size();
+    if (s.size() > capacity) return 0;
+    memory::copy(buffer, s.data(), s.size());
+    return s.size();
+}
+
+/* Loads a state from memory owned by the caller, which may be a mapped file.
+ * Every state load goes through here.
+ *   nall::serializer cannot borrow memory: it takes a copy of the data, which
+ * is the only time the bytes are read before the core unserializes them. */
+auto Program::unserialize(const uint8_t* data, uint size) -> bool
+{
+    if (!emulator->loaded() || !data || !size) return false;
+    serializer s(data, size);
+    return emulator->unserialize(s);
+}
+
+/* Runs the given amount of frames, optionally without any output conversion.
+ * The core is driven exactly like in -executeFrame, so the resulting state is
+ * the same regardless of the flags. `frameDone` is called after every frame,
+ * and its time is included in the measure. Returns the emulation speed in
+ * frames per second. */
+auto Program::advance(uint frames, uint flags, function<void ()> frameDone) -> double
+{
+    if (!emulator->loaded() || frames == 0) return 0.0;
+    
+    bool oldSkipVideo = skipVideo, oldSkipAudio = skipAudio;
+    skipVideo = oldSkipVideo || (flags & BSNESAdvanceSkipVideo);
+    skipAudio = oldSkipAudio || (flags & BSNESAdvanceSkipAudio);
+    
+    uint64_t start = chrono::nanosecond();
+    for (uint i = 0; i < frames; i++) {
+        emulator->run();
+        if (frameDone) frameDone();
+    }
+    uint64_t elapsed = chrono::nanosecond() - start;
+    
+    skipVideo = oldSkipVideo;
+    skipAudio = oldSkipAudio;
+    
+    if (elapsed == 0) return 0.0;
+    return (double)frames * 1e9 / (double)elapsed;
+}
+
+auto Program::setFastForward(bool enabled) -> void
+{
+    if (fastForward.enabled == enabled) return;
+    fastForward.enabled = enabled;
+    fastForward.frameCounter = 0;
+    fastForward.sampleCounter = 0;
+    
+    if (!fastForward.speedHacks) return;
+    /* The fast PPU and DSP are picked by the core at power-on and are already
+     * enabled by hackCompatibility() unless a game is known to break with them,
+     * so the coprocessor synchronization is the only speed hack that can be
+     * relaxed just for the duration of the fast-forward. */
+    if (enabled) {
+        fastForward.savedDelayedSync = ::SuperFamicom::configuration.hacks.coprocessor.delayedSync;
+        emulator->configure("Hacks/Coprocessor/DelayedSync", true);
+    } else {
+        emulator->configure("Hacks/Coprocessor/DelayedSync", fastForward.savedDelayedSync);
+    }
+}
+
 auto Program::updateVideoPalette() -> void
 {
     static const uint8 gammaRamp_colorEmulation[32] = {
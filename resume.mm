@@ -0,0 +1,165 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/stat.h>
+
+/* Instant resume.
+ *   When the emulation stops, the state is saved to the core's support
+ * directory, keyed by the SHA-256 of the ROM and by the serializer version of
+ * the core, along with the SHA-256 of the .srm file as it was at that point.
+ * The next time the game is loaded, the snapshot is read and decompressed on
+ * a background queue while the system powers on, and loaded before the first
+ * frame, so the game continues where it was left instead of booting.
+ *   If the .srm file changed in between (another emulator, a restored backup,
+ * a sync from another machine), the snapshot would undo that change on the
+ * next save, so it is discarded instead.
+ *   Snapshots of other versions of the core can never be loaded, and those of
+ * games which have not been stopped for a long time most likely belong to a
+ * ROM which is gone; both are removed whenever a game is loaded. */
+
+
+#pragma mark - Instant Resume
+
+
+struct ResumeSnapshot {
+    ResumeSnapshot(string directory, string sha256, string saveRamPath);
+
+    auto save() -> bool;
+    auto prepare() -> void;
+    auto restore() -> bool;
+    auto discard() -> void;
+    auto prune() -> void;
+
+    bool pending = false;   //a snapshot is being prepared, or is ready to restore
+
+private:
+    static constexpr uint64_t MaximumAge = 180 * 24 * 60 * 60;  //seconds
+
+    static auto fileHash(string path) -> string;
+
+    string directory;
+    string statePath;
+    string recordPath;      //holds the hash of the .srm matching the snapshot
+    string saveRamPath;
+    string sha256;
+
+    /* only touched from the state queue until restore() */
+    bool ready = false;
+    vector<uint8_t> state;
+};
+
+ResumeSnapshot::ResumeSnapshot(string directory, string sha256, string saveRamPath) : directory(directory), saveRamPath(saveRamPath), sha256(sha256)
+{
+    directory::create(directory);
+    string base = {directory, sha256, "-", Emulator::SerializerVersion};
+    statePath = {base, ".state"};
+    recordPath = {base, ".srm-sha256"};
+}
+
+/* SHA-256 of a file, or an empty string if it doesn't exist */
+auto ResumeSnapshot::fileHash(string path) -> string
+{
+    if (!file::exists(path)) return "";
+    return Hash::SHA256(file::read(path)).digest();
+}
+
+/* To be called when the emulation stops, once the .srm file has been saved */
+auto ResumeSnapshot::save() -> bool
+{
+    serializer s = emulator->serialize();
+    StateFile::Header header;
+    header.codec = StateFile::Codec::LZ4;
+    header.sha256 = sha256;
+    header.region = program->superFamicom.region;
+    header.serializerVersion = Emulator::SerializerVersion;
+
+    //the record is written last: without it, the snapshot is never used
+    file::remove(recordPath);
+    if (!StateFile::write(statePath, s.data(), s.size(), header)) return false;
+    string hash = fileHash(saveRamPath);
+    return OEBSNESWriteAtomically(recordPath, [&](FILE *fp) -> bool {
+        return fwrite(hash.data(), 1, hash.size(), fp) == hash.size();
+    });
+}
+
+/* Reads and checks the snapshot. Runs on the state queue. */
+auto ResumeSnapshot::prepare() -> void
+{
+    ready = false;
+    if (!file::exists(recordPath) || !file::exists(statePath)) return;
+    if (string::read(recordPath) != fileHash(saveRamPath)) {
+        NSLog(@"The battery save changed since the game was stopped, discarding the resume snapshot");
+        file::remove(recordPath);
+        file::remove(statePath);
+        return;
+    }
+
+    vector<uint8_t> data = file::read(statePath);
+    StateFile::Header header;
+    if (!StateFile::parse(data.data(), data.size(), header)) return;
+    if (header.sha256 != sha256 || header.serializerVersion != Emulator::SerializerVersion) return;
+    if (header.size > UINT_MAX) return;
+    state.resize(header.size);
+    ready = StateFile::decompress(header, data.data() + StateFile::Header::Size, data.size() - StateFile::Header::Size, state.data());
+}
+
+/* Loads the prepared snapshot, on the emulation thread, once prepare() is done */
+auto ResumeSnapshot::restore() -> bool
+{
+    pending = false;
+    bool result = ready && program->unserialize(state.data(), state.size());
+    ready = false;
+    state.reset();
+    return result;
+}
+
+/* Drops the prepared snapshot without loading it, on the emulation thread,
+ * once prepare() is done. Used when the emulated state is replaced or driven
+ * by something else, which the snapshot must not overwrite. */
+auto ResumeSnapshot::discard() -> void
+{
+    pending = false;
+    ready = false;
+    state.reset();
+}
+
+/* Removes the snapshots which cannot or will likely never be used again. Runs
+ * on the state queue. */
+auto ResumeSnapshot::prune() -> void
+{
+    uint64_t now = time(nullptr);
+    for (auto& name : directory::files(directory)) {
+        //names are made of the 64 digits of the hash, a dash, and the version
+        if (name.size() < 66 || name[64] != '-') continue;
+        string version = slice(name, 65);
+        if (auto extension = version.find(".")) version.resize(extension());
+        string path = {directory, name};
+        struct stat info;
+        if (stat(path, &info) != 0) continue;
+        bool stale = now > (uint64_t)info.st_mtime && now - info.st_mtime > MaximumAge;
+        if (version != Emulator::SerializerVersion || stale) file::remove(path);
+    }
+}
@@ -0,0 +1,236 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <atomic>
+
+/* Rewind buffer.
+ *   Only the most recent snapshot is kept in full. Every older snapshot is
+ * stored as the XOR of itself with the snapshot that follows it, so stepping
+ * back is a matter of XORing the newest delta into the full state, and the
+ * oldest deltas can be dropped at any time to stay within the memory budget.
+ *   Consecutive states differ in a few places only, so the deltas are mostly
+ * made of zeros; they are compressed with a zero-run codec on a background
+ * queue, which keeps the cost on the emulation thread to one pass over the
+ * state. The deltas waiting to be compressed count towards the memory
+ * budget as well; if the queue falls that far behind, the emulation thread
+ * waits for it. */
+
+
+#pragma mark - Delta Codec
+
+
+/* A compressed delta is a list of (zero run, literal run) pairs. Both lengths
+ * are stored as LEB128 varints and each pair is followed by the literal
+ * bytes. Runs of less than 8 zero bytes are kept in the literals. */
+struct DeltaCodec {
+    static auto compress(const uint8_t* data, uint size) -> vector<uint8_t>;
+    static auto decompress(const uint8_t* data, uint size, uint8_t* output, uint capacity) -> bool;
+};
+
+auto DeltaCodec::compress(const uint8_t* data, uint size) -> vector<uint8_t>
+{
+    vector<uint8_t> output;
+    output.reserve(size / 16);
+    auto varint = [&](uint value) {
+        while (value >= 0x80) { output.append(0x80 | (value & 0x7f)); value >>= 7; }
+        output.append(value);
+    };
+
+    uint offset = 0;
+    while (offset < size) {
+        uint zeros = 0;
+        while (offset + zeros < size && !data[offset + zeros]) zeros++;
+        offset += zeros;
+
+        uint literals = 0;
+        while (offset + literals < size) {
+            if (data[offset + literals]) { literals++; continue; }
+            uint run = 0;
+            while (run < 8 && offset + literals + run < size && !data[offset + literals + run]) run++;
+            if (run == 8 || offset + literals + run == size) break;
+            literals += run;
+        }
+
+        varint(zeros);
+        varint(literals);
+        for (uint n = 0; n < literals; n++) output.append(data[offset + n]);
+        offset += literals;
+    }
+    return output;
+}
+
+auto DeltaCodec::decompress(const uint8_t* data, uint size, uint8_t* output, uint capacity) -> bool
+{
+    const uint8_t* end = data + size;
+    auto varint = [&](uint& value) -> bool {
+        value = 0;
+        for (uint shift = 0; data < end && shift < 32; shift += 7) {
+            uint8_t byte = *data++;
+            value |= (uint)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    };
+
+    uint offset = 0;
+    while (data < end) {
+        uint zeros, literals;
+        if (!varint(zeros) || !varint(literals)) return false;
+        if (zeros > capacity - offset) return false;
+        memory::fill(output + offset, zeros);
+        offset += zeros;
+        if (literals > capacity - offset || literals > (uint)(end - data)) return false;
+        memory::copy(output + offset, data, literals);
+        offset += literals;
+        data += literals;
+    }
+    return offset == capacity;
+}
+
+
+#pragma mark - Rewind Buffer
+
+
+struct Rewind {
+    Rewind(uint interval, uint64_t budget);
+    ~Rewind();
+
+    auto frame() -> void;
+    auto step() -> bool;
+    auto reset() -> void;
+
+    const uint interval;       //frames between snapshots
+    const uint64_t budget;     //maximum size of the deltas, compressed or not
+
+private:
+    uint counter = 0;
+    vector<uint8_t> current;   //latest snapshot, only touched by the emulation thread
+    vector<uint8_t> scratch;
+    std::atomic<uint64_t> queued{0};  //size of the deltas waiting to be compressed
+
+    /* only touched from `queue` */
+    dispatch_queue_t queue;
+    vector<vector<uint8_t>> deltas;
+    uint64_t used = 0;
+};
+
+Rewind::Rewind(uint interval, uint64_t budget) : interval(max(1u, interval)), budget(budget)
+{
+    queue = dispatch_queue_create("org.openemu.BSNES.rewind", DISPATCH_QUEUE_SERIAL);
+}
+
+Rewind::~Rewind()
+{
+    //wait for the pending compressions, they reference this object
+    dispatch_sync(queue, ^{});
+}
+
+auto Rewind::reset() -> void
+{
+    dispatch_sync(queue, ^{
+        deltas.reset();
+        used = 0;
+    });
+    current.reset();
+    counter = 0;
+}
+
+/* To be called after every emulated frame */
+auto Rewind::frame() -> void
+{
+    if (++counter < interval) return;
+    counter = 0;
+
+    serializer s = emulator->serialize(false);
+    if (current.size() != s.size()) {
+        //first snapshot, or a different game: nothing to compute a delta against
+        reset();
+        current.resize(s.size());
+        memory::copy(current.data(), s.data(), s.size());
+        return;
+    }
+
+    if (queued + s.size() > budget) dispatch_sync(queue, ^{});
+    queued += s.size();
+
+    //delta = current ^ next, and current = next, in a single pass
+    auto delta = new vector<uint8_t>;
+    delta->resize(s.size());
+    const uint8_t* next = s.data();
+    uint8_t* state = current.data();
+    uint8_t* output = delta->data();
+    uint size = s.size(), offset = 0;
+    for (; offset + 8 <= size; offset += 8) {
+        uint64_t a, b;
+        memory::copy(&a, state + offset, 8);
+        memory::copy(&b, next + offset, 8);
+        a ^= b;
+        memory::copy(output + offset, &a, 8);
+        memory::copy(state + offset, &b, 8);
+    }
+    for (; offset < size; offset++) {
+        output[offset] = state[offset] ^ next[offset];
+        state[offset] = next[offset];
+    }
+
+    dispatch_async(queue, ^{
+        deltas.append(DeltaCodec::compress(delta->data(), delta->size()));
+        used += deltas.last().size();
+        queued -= delta->size();
+        delete delta;
+        while (used + queued > budget && deltas.size() > 1)
+            used -= deltas.takeFirst().size();
+    });
+}
+
+/* Restores the snapshot preceding the current one. Returns false when the
+ * buffer is exhausted, or when the core refused the snapshot (the buffer is
+ * then emptied, as every older snapshot depends on it). */
+auto Rewind::step() -> bool
+{
+    __block vector<uint8_t> delta;
+    dispatch_sync(queue, ^{
+        if (!deltas) return;
+        delta = deltas.takeLast();
+        used -= delta.size();
+    });
+    if (!delta) return false;
+
+    scratch.resize(current.size());
+    if (!DeltaCodec::decompress(delta.data(), delta.size(), scratch.data(), scratch.size())) {
+        reset();
+        return false;
+    }
+    for (uint offset = 0; offset < current.size(); offset++)
+        current[offset] ^= scratch[offset];
+
+    if (!program->unserialize(current.data(), current.size())) {
+        reset();
+        return false;
+    }
+    counter = 0;
+    return true;
+}
@@ -0,0 +1,253 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <compression.h>
+#include <fcntl.h>
+#include <lzma/LzmaEnc.h>
+#include <lzma/LzmaDec.h>
+
+/* Save state files.
+ *   A state file is a fixed-size header followed by the serialized state,
+ * compressed either with LZMA (from the LZMA SDK built with bsnes, best ratio)
+ * or with LZ4 (from the system's Compression library, fastest). Compression
+ * streams from the serializer to the file in small chunks, and decompression
+ * reads from the (mapped) file straight into the destination buffer, so there
+ * is never a second full copy of the state in memory.
+ *   Files without the header are states written by older versions of the
+ * core, which are the raw serializer data. */
+
+
+#pragma mark - State File Format
+
+
+struct StateFile {
+    enum class Codec : uint32_t { None = 0, LZMA = 1, LZ4 = 2 };
+
+    /* Format, integers are little-endian:
+     *   char[8] magic "BSNSTATE"
+     *   u32     container version
+     *   u32     codec
+     *   u64     uncompressed size
+     *   char[64] SHA-256 of the ROM, in hexadecimal
+     *   char[8] video region, NUL-padded
+     *   char[8] serializer version, NUL-padded
+     *   ...     payload; LZMA payloads start with the 5 property bytes */
+    struct Header {
+        static constexpr uint Size = 104;
+        static constexpr uint32_t Version = 1;
+
+        Codec codec = Codec::None;
+        uint64_t size = 0;
+        string sha256;
+        string region;
+        string serializerVersion;
+    };
+
+    static auto write(string path, const uint8_t* data, uint size, const Header& header) -> bool;
+    static auto parse(const uint8_t* data, uint size, Header& header) -> bool;
+    static auto decompress(const Header& header, const uint8_t* payload, uint payloadSize, uint8_t* output) -> bool;
+};
+
+static const char OEBSNESStateMagic[8] = {'B', 'S', 'N', 'S', 'T', 'A', 'T', 'E'};
+
+static void *OEBSNESLzmaAlloc(ISzAllocPtr, size_t size) { return malloc(size); }
+static void OEBSNESLzmaFree(ISzAllocPtr, void *address) { free(address); }
+static const ISzAlloc OEBSNESLzmaAllocator = { OEBSNESLzmaAlloc, OEBSNESLzmaFree };
+
+/* LZMA SDK stream adapters: reading from memory, writing to a FILE */
+struct OEBSNESLzmaInStream {
+    ISeqInStream vt;
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+};
+
+static SRes OEBSNESLzmaRead(const ISeqInStream *p, void *buf, size_t *size)
+{
+    auto stream = (OEBSNESLzmaInStream *)p;
+    size_t length = min(*size, stream->size - stream->offset);
+    memory::copy(buf, stream->data + stream->offset, length);
+    stream->offset += length;
+    *size = length;
+    return SZ_OK;
+}
+
+struct OEBSNESLzmaOutStream {
+    ISeqOutStream vt;
+    FILE *fp;
+};
+
+static size_t OEBSNESLzmaWrite(const ISeqOutStream *p, const void *buf, size_t size)
+{
+    return fwrite(buf, 1, size, ((OEBSNESLzmaOutStream *)p)->fp);
+}
+
+static auto OEBSNESWriteLZMA(FILE *fp, const uint8_t* data, uint size) -> bool
+{
+    CLzmaEncHandle encoder = LzmaEnc_Create(&OEBSNESLzmaAllocator);
+    if (!encoder) return false;
+
+    CLzmaEncProps props;
+    LzmaEncProps_Init(&props);
+    props.level = 5;
+    props.dictSize = 1 << 22;
+    props.reduceSize = size;
+    props.numThreads = 1;
+
+    Byte properties[LZMA_PROPS_SIZE];
+    SizeT propertiesSize = LZMA_PROPS_SIZE;
+    bool result = LzmaEnc_SetProps(encoder, &props) == SZ_OK
+        && LzmaEnc_WriteProperties(encoder, properties, &propertiesSize) == SZ_OK
+        && fwrite(properties, 1, propertiesSize, fp) == propertiesSize;
+    if (result) {
+        OEBSNESLzmaInStream input = {{OEBSNESLzmaRead}, data, size, 0};
+        OEBSNESLzmaOutStream output = {{OEBSNESLzmaWrite}, fp};
+        result = LzmaEnc_Encode(encoder, &output.vt, &input.vt, nullptr, &OEBSNESLzmaAllocator, &OEBSNESLzmaAllocator) == SZ_OK;
+    }
+    LzmaEnc_Destroy(encoder, &OEBSNESLzmaAllocator, &OEBSNESLzmaAllocator);
+    return result;
+}
+
+static auto OEBSNESWriteLZ4(FILE *fp, const uint8_t* data, uint size) -> bool
+{
+    compression_stream stream;
+    if (compression_stream_init(&stream, COMPRESSION_STREAM_ENCODE, COMPRESSION_LZ4) != COMPRESSION_STATUS_OK)
+        return false;
+
+    uint8_t buffer[64 * 1024];
+    stream.src_ptr = data;
+    stream.src_size = size;
+    bool result = true;
+    compression_status status;
+    do {
+        stream.dst_ptr = buffer;
+        stream.dst_size = sizeof(buffer);
+        status = compression_stream_process(&stream, COMPRESSION_STREAM_FINALIZE);
+        size_t length = sizeof(buffer) - stream.dst_size;
+        if (status == COMPRESSION_STATUS_ERROR || fwrite(buffer, 1, length, fp) != length)
+            result = false;
+    } while (result && status == COMPRESSION_STATUS_OK);
+    compression_stream_destroy(&stream);
+    return result;
+}
+
+/* Writes a file atomically through a temporary file, which `body` fills, and
+ * returns once the file is durable. Sets errno on failure. */
+static auto OEBSNESWriteAtomically(string path, const function<bool (FILE *)>& body) -> bool
+{
+    string temporary = {path, ".tmp"};
+    FILE *fp = fopen(temporary, "wb");
+    if (!fp) return false;
+    bool result = body(fp);
+    //the data must be on the disk before the rename makes it visible
+    result = result && fflush(fp) == 0 && fcntl(fileno(fp), F_FULLFSYNC) != -1;
+    result = fclose(fp) == 0 && result;
+    if (result) result = rename(temporary, path) == 0;
+    if (!result) {
+        int code = errno;
+        unlink(temporary);
+        errno = code;
+        return false;
+    }
+    //and so must be the rename itself
+    if (int directory = open(Location::path(path), O_RDONLY); directory >= 0) {
+        fsync(directory);
+        close(directory);
+    }
+    return true;
+}
+
+auto StateFile::write(string path, const uint8_t* data, uint size, const Header& header) -> bool
+{
+    uint8_t raw[Header::Size] = {};
+    memory::copy(raw, OEBSNESStateMagic, 8);
+    for (uint n = 0; n < 4; n++) raw[ 8 + n] = Header::Version >> (n * 8);
+    for (uint n = 0; n < 4; n++) raw[12 + n] = (uint32_t)header.codec >> (n * 8);
+    for (uint n = 0; n < 8; n++) raw[16 + n] = (uint64_t)size >> (n * 8);
+    memory::copy(raw + 24, header.sha256.data(), min(header.sha256.size(), 64));
+    memory::copy(raw + 88, header.region.data(), min(header.region.size(), 8));
+    memory::copy(raw + 96, header.serializerVersion.data(), min(header.serializerVersion.size(), 8));
+
+    return OEBSNESWriteAtomically(path, [&](FILE *fp) -> bool {
+        if (fwrite(raw, 1, sizeof(raw), fp) != sizeof(raw)) return false;
+        switch (header.codec) {
+        case Codec::None: return fwrite(data, 1, size, fp) == size;
+        case Codec::LZMA: return OEBSNESWriteLZMA(fp, data, size);
+        case Codec::LZ4:  return OEBSNESWriteLZ4(fp, data, size);
+        }
+        return false;
+    });
+}
+
+/* Reads the header of a state file. Returns false if the data doesn't start
+ * with a valid header, as is the case for the raw states of older versions. */
+auto StateFile::parse(const uint8_t* data, uint size, Header& header) -> bool
+{
+    if (size < Header::Size || memcmp(data, OEBSNESStateMagic, 8) != 0) return false;
+    auto integer = [&](uint offset, uint bytes) -> uint64_t {
+        uint64_t value = 0;
+        for (uint n = 0; n < bytes; n++) value |= (uint64_t)data[offset + n] << (n * 8);
+        return value;
+    };
+    auto text = [&](uint offset, uint length) -> string {
+        string value;
+        for (uint n = 0; n < length && data[offset + n]; n++) value.append((char)data[offset + n]);
+        return value;
+    };
+    if (integer(8, 4) != Header::Version) return false;
+    header.codec = (Codec)integer(12, 4);
+    header.size = integer(16, 8);
+    header.sha256 = text(24, 64);
+    header.region = text(88, 8);
+    header.serializerVersion = text(96, 8);
+    return header.codec <= Codec::LZ4;
+}
+
+/* Decompresses the payload into `output`, which must hold header.size bytes */
+auto StateFile::decompress(const Header& header, const uint8_t* payload, uint payloadSize, uint8_t* output) -> bool
+{
+    switch (header.codec) {
+    case Codec::None: {
+        if (payloadSize != header.size) return false;
+        memory::copy(output, payload, payloadSize);
+        return true;
+    }
+    case Codec::LZMA: {
+        if (payloadSize < LZMA_PROPS_SIZE) return false;
+        SizeT outputSize = header.size;
+        SizeT inputSize = payloadSize - LZMA_PROPS_SIZE;
+        ELzmaStatus status;
+        SRes result = LzmaDecode(output, &outputSize, payload + LZMA_PROPS_SIZE, &inputSize,
+            payload, LZMA_PROPS_SIZE, LZMA_FINISH_END, &status, &OEBSNESLzmaAllocator);
+        return result == SZ_OK && outputSize == header.size;
+    }
+    case Codec::LZ4: {
+        size_t outputSize = compression_decode_buffer(output, header.size, payload, payloadSize, nullptr, COMPRESSION_LZ4);
+        return outputSize == header.size;
+    }
+    }
+    return false;
+}
@@ -0,0 +1,460 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <emulator/emulator.hpp>
+using namespace nall;
+
+#include <heuristics/heuristics.hpp>
+#include <heuristics/heuristics.cpp>
+#include <heuristics/super-famicom.cpp>
+
+#include <dirent.h>
+#include <getopt.h>
+#include <atomic>
+#include <dispatch/dispatch.h>
+
+#include "mapping.mm"
+#include "archive.mm"
+#include "gamedb.mm"
+#include "sha256.mm"
+#include "hashcache.mm"
+
+/* bsnes-scan, the ROM library scanner.
+ *   Identifies every ROM of a directory tree the way the core does when it
+ * loads a game: the copier header is skipped, the ROM is hashed and looked up
+ * in the game database, and the heuristics describe the games which aren't in
+ * it. Each ROM is printed as one JSON object per line, sorted by path.
+ *   Directories and files are scanned as separate tasks on a concurrent
+ * dispatch queue, so a large directory doesn't hold up the others and every
+ * core stays busy; the ROMs are mapped, so several of them are read from the
+ * disk at once.
+ *   When the output file exists, the ROMs whose size and modification time
+ * did not change since it was written are not read again: their previous
+ * records are kept as they are. */
+
+
+#pragma mark - JSON
+
+
+static auto OEBSNESJSONString(const string& text) -> string
+{
+    string output = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            output.append('\\', c);
+        } else if ((uint8_t)c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            output.append(escape);
+        } else {
+            output.append(c);
+        }
+    }
+    return output.append("\"");
+}
+
+/* The raw value of a top-level field of one of our own records: strings are
+ * unescaped, anything else is returned as written */
+static auto OEBSNESJSONField(const string& line, const char* key) -> string
+{
+    auto position = line.find(string{"\"", key, "\":"});
+    if (!position) return {};
+    const char* p = line.data() + position() + strlen(key) + 3;
+    string value;
+    if (*p != '"') {
+        while (*p && *p != ',' && *p != '}') value.append(*p++);
+        return value;
+    }
+    for (p++; *p && *p != '"'; p++) {
+        if (*p != '\\') { value.append(*p); continue; }
+        switch (*++p) {
+        case 'n': value.append('\n'); break;
+        case 't': value.append('\t'); break;
+        case 'r': value.append('\r'); break;
+        case 'b': value.append('\b'); break;
+        case 'f': value.append('\f'); break;
+        case 'u': {
+            uint code = 0;
+            for (uint n = 0; n < 4 && p[1]; n++) {
+                char c = *++p;
+                code = code << 4 | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+            }
+            if (code < 0x80) {
+                value.append((char)code);
+            } else if (code < 0x800) {
+                value.append((char)(0xc0 | code >> 6), (char)(0x80 | (code & 0x3f)));
+            } else {
+                value.append((char)(0xe0 | code >> 12), (char)(0x80 | (code >> 6 & 0x3f)), (char)(0x80 | (code & 0x3f)));
+            }
+            break;
+        }
+        case '\0': return value;
+        default: value.append(*p); break;
+        }
+    }
+    return value;
+}
+
+
+#pragma mark - Boards
+
+
+/* The chips of the boards of boards.bml, as JSON arrays, by board name. A
+ * board listing several revisions, as in SHVC-1A3B-(11,12,13), gets an entry
+ * for each of them. Only read once it is built, so it can be shared between
+ * threads; the arrays are std::strings, which are never shared by copies. */
+struct BoardIndex {
+    auto open(string path) -> bool;
+    auto chips(string board) const -> const char*;
+
+private:
+    static auto collect(Markup::Node node, vector<string>& chips) -> void;
+
+    std::map<string, std::string> boards;
+};
+
+auto BoardIndex::collect(Markup::Node node, vector<string>& chips) -> void
+{
+    for (auto child : node) {
+        string chip;
+        if (child.name() == "processor") {
+            chip = child["architecture"].text();
+            if (!chip) chip = child["identifier"].text();
+        } else if (child.name() == "rtc") {
+            chip = {child["manufacturer"].text(), " RTC"};
+        }
+        if (chip && !chips.find(chip)) chips.append(chip);
+        collect(child, chips);
+    }
+}
+
+auto BoardIndex::open(string path) -> bool
+{
+    auto document = BML::unserialize(string::read(path));
+    for (auto leaf : document.find("board")) {
+        vector<string> list;
+        collect(leaf, list);
+        string array = "[";
+        for (auto& chip : list) array.append(array.size() > 1 ? "," : "", OEBSNESJSONString(chip));
+        array.append("]");
+        std::string chips = array.data();
+
+        //same matching as SuperFamicom::Cartridge::loadBoard
+        string id = leaf.text();
+        auto part = string{id}.transform("()", "||").split("|");
+        if (part.size() == 3) {
+            for (auto& revision : part[1].split(",")) boards[{part[0], revision, part[2]}] = chips;
+        } else {
+            boards[id] = chips;
+        }
+    }
+    return !boards.empty();
+}
+
+auto BoardIndex::chips(string board) const -> const char*
+{
+    for (auto prefix : {"SNSP-", "MAXI-", "MJSC-", "EA-", "WEI-"}) {
+        if (board.beginsWith(prefix)) board.replace(prefix, "SHVC-", 1L);
+    }
+    auto entry = boards.find(board);
+    return entry != boards.end() ? entry->second.c_str() : "[]";
+}
+
+
+#pragma mark - Scanner
+
+
+struct Scanner {
+    Scanner(const GameDatabase& database, const BoardIndex& boards);
+
+    /* Keeps the records of a previous scan for the files which didn't change */
+    auto reuse(string path) -> void;
+    /* Scans a directory tree or a single file in the background */
+    auto scan(string path) -> void;
+    /* Waits for the scan to complete, and returns the records sorted by path */
+    auto finish() -> vector<string>;
+
+    std::atomic<uint> identified{0};
+    std::atomic<uint> reused{0};
+    std::atomic<uint> failed{0};
+
+private:
+    auto scanDirectory(string path) -> void;
+    auto scanFile(string path) -> void;
+    auto identify(string path) -> string;
+    auto add(string record) -> void;
+
+    const GameDatabase& database;
+    const BoardIndex& boards;
+    dispatch_queue_t queue;
+    dispatch_group_t group;
+
+    /* nall strings share their buffers without atomic reference counts, so
+     * the strings are handed over between threads by moving them */
+    std::mutex mutex;
+    std::map<string, string> previous;   //records of the previous scan, by path
+    vector<string> records;
+};
+
+Scanner::Scanner(const GameDatabase& database, const BoardIndex& boards) : database(database), boards(boards)
+{
+    queue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+    group = dispatch_group_create();
+}
+
+static auto OEBSNESIsScannable(string name) -> bool
+{
+    if (OEBSNESIsRomName(name)) return true;
+    name.downcase();
+    for (auto extension : {".zip", ".gz", ".xz", ".7z"}) {
+        if (name.endsWith(extension)) return true;
+    }
+    return false;
+}
+
+auto Scanner::reuse(string path) -> void
+{
+    for (auto& line : string::read(path).split("\n")) {
+        if (auto key = OEBSNESJSONField(line, "path")) previous[key] = line;
+    }
+}
+
+auto Scanner::scan(string path) -> void
+{
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        fprintf(stderr, "bsnes-scan: %s: %s\n", path.data(), strerror(errno));
+        return;
+    }
+    path.trimRight("/", 1L);
+    auto task = new string{path};
+    bool directory = S_ISDIR(info.st_mode);
+    dispatch_group_async(group, queue, ^{
+        if (directory) scanDirectory(move(*task));
+        else scanFile(move(*task));
+        delete task;
+    });
+}
+
+auto Scanner::scanDirectory(string path) -> void
+{
+    DIR *directory = opendir(path);
+    if (!directory) return;
+    while (auto entry = readdir(directory)) {
+        if (entry->d_name[0] == '.') continue;   //also skips "." and ".."
+        bool isDirectory = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat info;
+            string child = {path, "/", entry->d_name};
+            isDirectory = lstat(child, &info) == 0 && S_ISDIR(info.st_mode);
+        }
+        if (!isDirectory && !OEBSNESIsScannable(entry->d_name)) continue;
+
+        //symbolic links to directories are not followed, there could be loops
+        auto task = new string{path, "/", entry->d_name};
+        dispatch_group_async(group, queue, ^{
+            if (isDirectory) scanDirectory(move(*task));
+            else scanFile(move(*task));
+            delete task;
+        });
+    }
+    closedir(directory);
+}
+
+auto Scanner::scanFile(string path) -> void
+{
+    auto identity = HashCache::identify(path);
+    if (!identity) return;
+    string prefix = {
+        "{\"path\":", OEBSNESJSONString(path),
+        ",\"size\":", identity().size,
+        ",\"mtime\":", identity().time, ","
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto entry = previous.find(path);
+        if (entry != previous.end()) {
+            string record = move(entry->second);
+            previous.erase(entry);
+            if (record.beginsWith(prefix)) {
+                records.append(move(record));
+                reused++;
+                return;
+            }
+        }
+    }
+
+    string record = identify(path);
+    if (!record) {
+        failed++;
+        record = "\"error\":\"not a Super Famicom ROM\"}";
+    } else {
+        identified++;
+    }
+    add(prefix.append(record));
+}
+
+/* The fields of the record which follow the path, size and modification
+ * time, or nothing if the file isn't a ROM which can be read */
+auto Scanner::identify(string path) -> string
+{
+    auto image = OEBSNESOpenRom(path);
+    if (!image) return {};
+    uint8_t* romData = image->data;
+    uint romSize = image->size;
+    if ((romSize & 0x7fff) == 512) {
+        romData += 512;
+        romSize -= 512;
+    }
+    if (romSize < 0x8000) return {};
+
+    SHA256 hash;
+    hash.input(romData, romSize);
+    string sha256 = hash.digest();
+
+    VectorAlias alias(romData, romSize);
+    Heuristics::SuperFamicom heuristics(alias.vector, path);
+    string manifest = database.find(sha256);
+    bool verified = (bool)manifest;
+    if (!verified) manifest = heuristics.manifest();
+    auto game = BML::unserialize(manifest)["game"];
+
+    string title = verified ? game["label"].text() : heuristics.title();
+    string board = game["board"].text();
+    const char* chips = boards.chips(board);
+    //the program and data ROMs of a chip carry the same identifier
+    vector<string> identifiers;
+    for (auto memory : game["board"].find("memory")) {
+        string identifier = memory["identifier"].text().downcase();
+        if (identifier && !identifiers.find(identifier)) identifiers.append(identifier);
+    }
+    string firmware = "[";
+    for (auto& identifier : identifiers)
+        firmware.append(firmware.size() > 1 ? "," : "", OEBSNESJSONString(identifier));
+    firmware.append("]");
+
+    return {
+        "\"sha256\":", OEBSNESJSONString(sha256),
+        ",\"title\":", OEBSNESJSONString(title),
+        ",\"region\":", OEBSNESJSONString(game["region"].text()),
+        ",\"video\":", OEBSNESJSONString(heuristics.videoRegion()),
+        ",\"board\":", OEBSNESJSONString(board),
+        ",\"chips\":", chips,
+        ",\"verified\":", verified ? "true" : "false",
+        ",\"firmware\":", firmware, "}"
+    };
+}
+
+auto Scanner::add(string record) -> void
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    records.append(move(record));
+}
+
+auto Scanner::finish() -> vector<string>
+{
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    std::lock_guard<std::mutex> lock(mutex);
+    previous.clear();
+    records.sort();
+    return move(records);
+}
+
+
+#pragma mark - Main
+
+
+static void OEBSNESUsage()
+{
+    fprintf(stderr,
+        "usage: bsnes-scan [-o output] [-d database] [-b boards] [-i index] path...\n"
+        "  -o  write the records to this file instead of the standard output; the\n"
+        "      records it already holds are kept for the files which didn't change\n"
+        "  -d  game database (default: Super Famicom.bml of the core next to this tool)\n"
+        "  -b  board database (default: boards.bml of the core next to this tool)\n"
+        "  -i  where to keep the index of the game database (default: in %s)\n",
+        Path::temporary().data());
+}
+
+int main(int argc, char *argv[])
+{
+    string resources = {Path::program(), "BSNES.oecoreplugin/Contents/Resources/"};
+    string output;
+    string databasePath = {resources, "Super Famicom.bml"};
+    string boardsPath = {resources, "boards.bml"};
+    string indexPath = {Path::temporary(), "bsnes-scan.index"};
+
+    int option;
+    while ((option = getopt(argc, argv, "o:d:b:i:h")) != -1) {
+        switch (option) {
+        case 'o': output = optarg; break;
+        case 'd': databasePath = optarg; break;
+        case 'b': boardsPath = optarg; break;
+        case 'i': indexPath = optarg; break;
+        default: OEBSNESUsage(); return 1;
+        }
+    }
+    if (optind == argc) {
+        OEBSNESUsage();
+        return 1;
+    }
+
+    GameDatabase database;
+    if (!database.open(indexPath, databasePath)) {
+        fprintf(stderr, "bsnes-scan: cannot open the game database %s\n", databasePath.data());
+        return 1;
+    }
+    BoardIndex boards;
+    if (!boards.open(boardsPath)) {
+        fprintf(stderr, "bsnes-scan: cannot open the board database %s\n", boardsPath.data());
+        return 1;
+    }
+
+    uint64_t start = chrono::millisecond();
+    Scanner scanner(database, boards);
+    if (output) scanner.reuse(output);
+    for (int n = optind; n < argc; n++) scanner.scan(argv[n]);
+    auto records = scanner.finish();
+
+    string contents;
+    for (auto& record : records) contents.append(record, "\n");
+    if (output) {
+        string temporary = {output, ".", getpid(), ".tmp"};
+        if (!file::write(temporary, contents) || rename(temporary, output) != 0) {
+            fprintf(stderr, "bsnes-scan: cannot write %s: %s\n", output.data(), strerror(errno));
+            file::remove(temporary);
+            return 1;
+        }
+    } else {
+        fwrite(contents.data(), 1, contents.size(), stdout);
+    }
+
+    fprintf(stderr, "bsnes-scan: %u ROMs identified, %u unchanged, %u failed, in %.1f s\n",
+        scanner.identified.load(), scanner.reused.load(), scanner.failed.load(),
+        (chrono::millisecond() - start) / 1000.0);
+    return 0;
+}
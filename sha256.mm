@@ -0,0 +1,275 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+/* SHA-256 using the instructions for it when the processor has them: the
+ * SHA extensions on x86 (Intel since Ice Lake and Goldmont, AMD since Zen),
+ * the cryptography extensions on ARMv8 (every Apple processor). Hashing the
+ * ROM is on the load path of every game, and the dedicated instructions are
+ * several times faster than nall's portable implementation, which is what
+ * is used otherwise.
+ *   This file is plain C++, so other tools can share it. The processor is
+ * queried through sysctl on Apple systems and the auxiliary vector on Linux;
+ * elsewhere on ARM the dedicated path is only taken when the compiler targets
+ * the extension. */
+
+
+#pragma mark - SHA-256
+
+
+struct SHA256 {
+    SHA256();
+
+    auto input(const uint8_t* data, uint64_t size) -> void;
+    auto digest() -> string;   //lowercase hexadecimal, like nall's
+
+    /* which implementation is in use */
+    static auto implementation() -> const char*;
+
+private:
+    using Compress = void (*)(uint32_t state[8], const uint8_t* data, uint64_t blocks);
+    static auto select() -> Compress;
+    static const Compress compress;
+
+    uint32_t state[8];
+    uint8_t buffer[64];
+    uint bufferSize = 0;
+    uint64_t length = 0;
+};
+
+static const uint32_t SHA256Constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void SHA256CompressPortable(uint32_t state[8], const uint8_t* data, uint64_t blocks)
+{
+    auto ror = [](uint32_t x, uint n) -> uint32_t { return x >> n | x << (32 - n); };
+    for (; blocks; blocks--, data += 64) {
+        uint32_t w[64];
+        for (uint n = 0; n < 16; n++)
+            w[n] = data[n * 4] << 24 | data[n * 4 + 1] << 16 | data[n * 4 + 2] << 8 | data[n * 4 + 3];
+        for (uint n = 16; n < 64; n++) {
+            uint32_t s0 = ror(w[n - 15], 7) ^ ror(w[n - 15], 18) ^ w[n - 15] >> 3;
+            uint32_t s1 = ror(w[n - 2], 17) ^ ror(w[n - 2], 19) ^ w[n - 2] >> 10;
+            w[n] = w[n - 16] + s0 + w[n - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (uint n = 0; n < 64; n++) {
+            uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + SHA256Constants[n] + w[n];
+            uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* The state is kept as ABEF/CDGH, the layout sha256rnds2 works with */
+__attribute__((target("sha,sse4.1")))
+static void SHA256CompressSHANI(uint32_t state[8], const uint8_t* data, uint64_t blocks)
+{
+    const __m128i shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);         //CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1b);   //EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);   //ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);        //CDGH
+
+    for (; blocks; blocks--, data += 64) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i msg[4];
+        for (uint n = 0; n < 4; n++)
+            msg[n] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + n * 16)), shuffle);
+
+        //each iteration does four rounds, msg[i & 3] holding their message words
+        for (uint round = 0; round < 16; round++) {
+            __m128i m = _mm_add_epi32(msg[round & 3], _mm_loadu_si128((const __m128i*)&SHA256Constants[round * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+            m = _mm_shuffle_epi32(m, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, m);
+            if (round < 12) {
+                //the words of iteration round + 4 replace the ones just used
+                __m128i w0 = msg[round & 3], w1 = msg[(round + 1) & 3];
+                __m128i w2 = msg[(round + 2) & 3], w3 = msg[(round + 3) & 3];
+                __m128i t = _mm_sha256msg1_epu32(w0, w1);
+                t = _mm_add_epi32(t, _mm_alignr_epi8(w3, w2, 4));
+                msg[round & 3] = _mm_sha256msg2_epu32(t, w3);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);        //FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xb1);     //DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);  //DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     //HGFE
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+#endif
+
+#if defined(__aarch64__)
+#if !defined(__ARM_FEATURE_SHA2)
+__attribute__((target("crypto")))
+#endif
+static void SHA256CompressARMv8(uint32_t state[8], const uint8_t* data, uint64_t blocks)
+{
+    uint32x4_t state0 = vld1q_u32(&state[0]);
+    uint32x4_t state1 = vld1q_u32(&state[4]);
+
+    for (; blocks; blocks--, data += 64) {
+        uint32x4_t abcd = state0, efgh = state1;
+        uint32x4_t msg[4];
+        for (uint n = 0; n < 4; n++)
+            msg[n] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + n * 16)));
+
+        //each iteration does four rounds, msg[i & 3] holding their message words
+        for (uint round = 0; round < 16; round++) {
+            uint32x4_t m = vaddq_u32(msg[round & 3], vld1q_u32(&SHA256Constants[round * 4]));
+            uint32x4_t previous = state0;
+            state0 = vsha256hq_u32(state0, state1, m);
+            state1 = vsha256h2q_u32(state1, previous, m);
+            if (round < 12) {
+                uint32x4_t w0 = msg[round & 3], w1 = msg[(round + 1) & 3];
+                uint32x4_t w2 = msg[(round + 2) & 3], w3 = msg[(round + 3) & 3];
+                msg[round & 3] = vsha256su1q_u32(vsha256su0q_u32(w0, w1), w2, w3);
+            }
+        }
+
+        state0 = vaddq_u32(state0, abcd);
+        state1 = vaddq_u32(state1, efgh);
+    }
+
+    vst1q_u32(&state[0], state0);
+    vst1q_u32(&state[4], state1);
+}
+#endif
+
+auto SHA256::select() -> Compress
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint eax, ebx, ecx, edx;
+    bool sse41 = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1);
+    bool sha = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1 << 29));
+    if (sse41 && sha) return SHA256CompressSHANI;
+#elif defined(__aarch64__) && defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    //the key only exists on recent systems; every Apple ARM processor has the extension
+    if (sysctlbyname("hw.optional.arm.FEAT_SHA256", &value, &size, nullptr, 0) != 0 || value)
+        return SHA256CompressARMv8;
+#elif defined(__aarch64__) && defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_SHA2) return SHA256CompressARMv8;
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_SHA2)
+    //no way to ask the system, but the compiler was told the extension is there
+    return SHA256CompressARMv8;
+#endif
+    return SHA256CompressPortable;
+}
+
+const SHA256::Compress SHA256::compress = SHA256::select();
+
+auto SHA256::implementation() -> const char*
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (compress == SHA256CompressSHANI) return "SHA extensions";
+#elif defined(__aarch64__)
+    if (compress == SHA256CompressARMv8) return "ARMv8 cryptography extensions";
+#endif
+    return "portable";
+}
+
+SHA256::SHA256()
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(state, initial, sizeof(state));
+}
+
+auto SHA256::input(const uint8_t* data, uint64_t size) -> void
+{
+    length += size;
+    if (bufferSize) {
+        uint count = min((uint64_t)(64 - bufferSize), size);
+        memcpy(buffer + bufferSize, data, count);
+        bufferSize += count;
+        data += count;
+        size -= count;
+        if (bufferSize < 64) return;
+        compress(state, buffer, 1);
+        bufferSize = 0;
+    }
+    if (size >= 64) {
+        compress(state, data, size / 64);
+        data += size & ~63ull;
+        size &= 63;
+    }
+    memcpy(buffer, data, size);
+    bufferSize = size;
+}
+
+auto SHA256::digest() -> string
+{
+    uint64_t bits = length * 8;
+    uint8_t padding[72] = {0x80};
+    uint paddingSize = (bufferSize < 56 ? 56 : 120) - bufferSize;
+    for (uint n = 0; n < 8; n++) padding[paddingSize + n] = bits >> (56 - n * 8);
+    input(padding, paddingSize + 8);
+
+    string result;
+    for (uint n = 0; n < 32; n++) {
+        static const char hex[] = "0123456789abcdef";
+        uint8_t byte = state[n / 4] >> (24 - (n & 3) * 8);
+        result.append(hex[byte >> 4], hex[byte & 15]);
+    }
+    return result;
+}
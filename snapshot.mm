@@ -0,0 +1,272 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Page-based snapshots.
+ *   A serialized state is mostly made of the memories of the system (WRAM,
+ * VRAM, ARAM, cartridge RAM...), of which only a few pages change from one
+ * frame to the next. The memories are owned by the core, which does not
+ * report writes to them, so the pages that changed are found by comparing
+ * each state with the previous one, page by page. Comparing is a lot cheaper
+ * than storing or transmitting the whole state again. */
+
+
+#pragma mark - Incremental Snapshots
+
+
+/* Produces snapshots which only contain the pages that changed since the
+ * previous snapshot produced (or applied) by the same object. Format, all
+ * little-endian:
+ *   u32 magic, u32 state size, u32 page size, u32 page count,
+ *   then for each page: u32 page index, page data
+ * The last page of the state may be shorter than the page size. */
+struct IncrementalSnapshot {
+    static constexpr uint32_t Magic = 0x53494e42;  //"BNIS"
+
+    IncrementalSnapshot(uint pageSize);
+
+    auto capture() -> vector<uint8_t>;
+    auto apply(const uint8_t* data, uint size) -> bool;
+    auto reset() -> void { reference.reset(); }
+
+    const uint pageSize;
+
+private:
+    vector<uint8_t> reference;   //the state of the previous snapshot
+};
+
+/* page sizes are powers of two between 256 bytes and 4 KiB */
+static auto OEBSNESPageSize(uint size) -> uint
+{
+    uint pageSize = 256;
+    while (pageSize < size && pageSize < 4096) pageSize <<= 1;
+    return pageSize;
+}
+
+IncrementalSnapshot::IncrementalSnapshot(uint pageSize) : pageSize(OEBSNESPageSize(pageSize))
+{
+}
+
+static auto OEBSNESWrite32(vector<uint8_t>& output, uint32_t value) -> void
+{
+    for (uint n = 0; n < 4; n++) output.append(value >> (n * 8));
+}
+
+static auto OEBSNESRead32(const uint8_t* data) -> uint32_t
+{
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+auto IncrementalSnapshot::capture() -> vector<uint8_t>
+{
+    serializer s = emulator->serialize(false);
+    const uint8_t* state = s.data();
+    uint size = s.size();
+    //without a reference of the same size, every page has to be sent
+    bool full = reference.size() != size;
+    if (full) reference.resize(size);
+
+    vector<uint8_t> output;
+    OEBSNESWrite32(output, Magic);
+    OEBSNESWrite32(output, size);
+    OEBSNESWrite32(output, pageSize);
+    OEBSNESWrite32(output, 0);
+
+    uint32_t pages = 0;
+    for (uint offset = 0; offset < size; offset += pageSize) {
+        uint length = min(pageSize, size - offset);
+        if (!full && memcmp(&reference[offset], &state[offset], length) == 0) continue;
+        memory::copy(&reference[offset], &state[offset], length);
+        OEBSNESWrite32(output, offset / pageSize);
+        uint position = output.size();
+        output.resize(position + length);
+        memory::copy(&output[position], &state[offset], length);
+        pages++;
+    }
+    for (uint n = 0; n < 4; n++) output[12 + n] = pages >> (n * 8);
+    return output;
+}
+
+/* Applies a snapshot produced by another IncrementalSnapshot object whose
+ * previous snapshot was the same as ours, and loads the resulting state. The
+ * whole snapshot is checked before any page is applied, so a malformed one
+ * leaves the reference untouched. */
+auto IncrementalSnapshot::apply(const uint8_t* data, uint size) -> bool
+{
+    if (size < 16 || OEBSNESRead32(data) != Magic) return false;
+    uint stateSize = OEBSNESRead32(data + 4);
+    uint sourcePageSize = OEBSNESRead32(data + 8);
+    uint pages = OEBSNESRead32(data + 12);
+    if (sourcePageSize != pageSize) return false;
+
+    //calls `body(offset, page, length)` for every page, or returns false
+    auto pagesOf = [&](auto&& body) -> bool {
+        uint position = 16;
+        for (uint n = 0; n < pages; n++) {
+            if (size - position < 4) return false;
+            uint64_t offset = (uint64_t)OEBSNESRead32(data + position) * pageSize;
+            position += 4;
+            if (offset >= stateSize) return false;
+            uint length = min(pageSize, stateSize - (uint)offset);
+            if (size - position < length) return false;
+            body((uint)offset, data + position, length);
+            position += length;
+        }
+        return true;
+    };
+    if (!pagesOf([](uint, const uint8_t*, uint) {})) return false;
+
+    if (reference.size() != stateSize) reference.resize(stateSize);
+    pagesOf([&](uint offset, const uint8_t* page, uint length) {
+        memory::copy(&reference[offset], page, length);
+    });
+
+    return program->unserialize(reference.data(), reference.size());
+}
+
+
+#pragma mark - State Tree
+
+
+/* A tree of snapshots sharing their unchanged pages. Each node holds a table
+ * of reference-counted pages; capturing a child only allocates the pages that
+ * differ from its parent, and forking a node shares its whole table until one
+ * of the two is captured over. Memory use is thus proportional to the pages
+ * that differ between the nodes.
+ *   The memories live inside the core, so restoring a node still assembles
+ * its pages into a full state for the core to unserialize. */
+struct StateTree {
+    static constexpr uint None = ~0u;
+
+    StateTree(uint pageSize) : pageSize(OEBSNESPageSize(pageSize)) {}
+
+    auto capture(uint parent = None) -> uint;
+    auto fork(uint node) -> uint;
+    auto restore(uint node) -> bool;
+    auto release(uint node) -> void;
+    auto reset() -> void;
+
+    auto nodeCount() const -> uint { return nodes.size() - freeNodes.size(); }
+    auto memoryUsage() const -> uint64_t { return usage; }
+
+    const uint pageSize;
+
+private:
+    struct Page {
+        Page(const uint8_t* source, uint length, uint64_t& usage) : usage(usage) {
+            data.resize(length);
+            memory::copy(data.data(), source, length);
+            usage += length;
+        }
+        ~Page() { usage -= data.size(); }
+
+        vector<uint8_t> data;
+        uint64_t& usage;
+    };
+    using PageTable = vector<shared_pointer<Page>>;
+
+    struct Node {
+        shared_pointer<PageTable> table;   //null for a released node
+        uint stateSize = 0;
+    };
+
+    auto allocate() -> uint;
+    auto valid(uint node) const -> bool { return node < nodes.size() && nodes[node].table; }
+
+    uint64_t usage = 0;        //bytes held by the pages, declared first to outlive them
+    vector<Node> nodes;
+    vector<uint> freeNodes;
+    vector<uint8_t> scratch;   //restored states are assembled here
+};
+
+auto StateTree::allocate() -> uint
+{
+    if (freeNodes) return freeNodes.takeLast();
+    nodes.append(Node{});
+    return nodes.size() - 1;
+}
+
+/* Snapshots the current state as a child of `parent`, or as a root */
+auto StateTree::capture(uint parent) -> uint
+{
+    serializer s = emulator->serialize(false);
+    const uint8_t* state = s.data();
+    uint size = s.size();
+    //pages can only be shared with a parent of the same layout
+    const PageTable* base = valid(parent) && nodes[parent].stateSize == size ? nodes[parent].table.data() : nullptr;
+
+    shared_pointer<PageTable> table{new PageTable};
+    table->reserve((size + pageSize - 1) / pageSize);
+    for (uint offset = 0, index = 0; offset < size; offset += pageSize, index++) {
+        uint length = min(pageSize, size - offset);
+        if (base && memcmp((*base)[index]->data.data(), &state[offset], length) == 0) {
+            table->append((*base)[index]);
+        } else {
+            table->append(shared_pointer<Page>{new Page(&state[offset], length, usage)});
+        }
+    }
+
+    uint node = allocate();
+    nodes[node].table = table;
+    nodes[node].stateSize = size;
+    return node;
+}
+
+/* Creates a node identical to `node`, in constant time */
+auto StateTree::fork(uint node) -> uint
+{
+    if (!valid(node)) return None;
+    uint child = allocate();
+    nodes[child] = nodes[node];
+    return child;
+}
+
+auto StateTree::restore(uint node) -> bool
+{
+    if (!valid(node)) return false;
+    const Node& source = nodes[node];
+    if (scratch.size() != source.stateSize) scratch.resize(source.stateSize);
+    uint offset = 0;
+    for (auto& page : *source.table) {
+        memory::copy(&scratch[offset], page->data.data(), page->data.size());
+        offset += page->data.size();
+    }
+    return program->unserialize(scratch.data(), scratch.size());
+}
+
+/* Frees a node. The pages it shares with other nodes stay alive. */
+auto StateTree::release(uint node) -> void
+{
+    if (!valid(node)) return;
+    nodes[node] = Node{};
+    freeNodes.append(node);
+}
+
+auto StateTree::reset() -> void
+{
+    nodes.reset();
+    freeNodes.reset();
+    scratch.reset();
+}
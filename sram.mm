@@ -0,0 +1,126 @@
+/*
+ Copyright (c) 2026, OpenEmu Team
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright
+       notice, this list of conditions and the following disclaimer in the
+       documentation and/or other materials provided with the distribution.
+     * Neither the name of the OpenEmu Team nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY OpenEmu Team ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL OpenEmu Team BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Background battery RAM flushing.
+ *   The core does not report writes to the cartridge RAM, so every 30 calls
+ * to -executeFrame (half a second at normal speed) the RAM is captured
+ * (through Program::captureSaveRam, which covers SA-1 BW-RAM and SuperFX RAM
+ * as well) and compared with the previous capture. Once it has changed and
+ * then stayed the same for a while, or has kept changing for too long, the
+ * capture is written to the .srm file on a background queue, so a crash
+ * loses at most a few seconds of progress.
+ * The emulation thread never waits for the disk. */
+
+
+#pragma mark - Battery RAM Flushing
+
+
+struct SaveRamFlush {
+    static constexpr uint CheckInterval = 30;  //frames between two captures
+    static constexpr uint QuietChecks = 2;     //unchanged captures before flushing
+    static constexpr uint MaximumChecks = 20;  //flush anyway after this many changed captures
+
+    SaveRamFlush();
+    ~SaveRamFlush();
+
+    auto frame() -> void;
+    auto drain() -> void;
+    auto reset() -> void;
+
+private:
+    uint counter = 0;
+    uint quiet = 0;
+    uint pending = 0;              //captures since the first unflushed change
+    bool dirty = false;
+    bool baseline = false;         //whether `previous` holds the RAM as loaded
+    vector<uint8_t> previous;      //last capture
+
+    dispatch_queue_t queue;
+};
+
+SaveRamFlush::SaveRamFlush()
+{
+    queue = dispatch_queue_create("org.openemu.BSNES.saveram", DISPATCH_QUEUE_SERIAL);
+}
+
+SaveRamFlush::~SaveRamFlush()
+{
+    drain();
+}
+
+/* Waits for the pending writes */
+auto SaveRamFlush::drain() -> void
+{
+    dispatch_sync(queue, ^{});
+}
+
+/* To be called when a game is loaded or reset */
+auto SaveRamFlush::reset() -> void
+{
+    counter = quiet = pending = 0;
+    dirty = baseline = false;
+    previous.reset();
+}
+
+/* To be called after every emulated frame */
+auto SaveRamFlush::frame() -> void
+{
+    if (++counter < CheckInterval) return;
+    counter = 0;
+
+    vector<uint8_t> current = program->captureSaveRam();
+    if (!current) return;
+    if (!baseline) {
+        //the first capture is what was loaded from the disk
+        previous = move(current);
+        baseline = true;
+        return;
+    }
+
+    bool changed = current.size() != previous.size() || memcmp(current.data(), previous.data(), current.size()) != 0;
+    if (changed) {
+        dirty = true;
+        quiet = 0;
+        previous = move(current);
+    } else {
+        quiet++;
+    }
+    if (!dirty) return;
+    pending++;
+    if (quiet < QuietChecks && pending < MaximumChecks) return;
+
+    dirty = false;
+    quiet = pending = 0;
+    auto snapshot = new vector<uint8_t>(previous);
+    string path = program->saveRamPath();
+    dispatch_async(queue, ^{
+        bool success = OEBSNESWriteAtomically(path, [&](FILE *fp) -> bool {
+            return fwrite(snapshot->data(), 1, snapshot->size(), fp) == snapshot->size();
+        });
+        if (!success) NSLog(@"Failed to write the battery save %s: %s", path.begin(), strerror(errno));
+        delete snapshot;
+    });
+}